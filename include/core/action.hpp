@@ -3,6 +3,7 @@
 #include "core/game_object.hpp"
 #include "core/serialization/action_serialization.pb.h"
 #include "core/snapshot.hpp"
+#include "core/value_schema.hpp"
 
 namespace core {
 
@@ -40,6 +41,13 @@ public:
 
     serialization::Action serialize() const;
 
+    /**
+     * Serializes the action in place, allocated on the arena of the message
+     * if it has one.
+     * @param action, the message to fill.
+     */
+    void serialize_to(serialization::Action* action) const;
+
     static std::unique_ptr<GameAction>
     deserialize(serialization::Action const& buffer);
 
@@ -54,7 +62,7 @@ protected:
 
     std::uint32_t _id;
 
-    std::map<std::string, GameValue*> _values;
+    ValueTable _values;
 };
 
 /**
@@ -74,6 +82,12 @@ struct ActionStatus {
 
     serialization::ActionStatus serialize() const;
 
+    /**
+     * Serializes the status in place, see GameAction::serialize_to().
+     * @param buffer, the message to fill.
+     */
+    void serialize_to(serialization::ActionStatus* buffer) const;
+
     static ActionStatus deserialize(serialization::ActionStatus const& buffer);
 };
 
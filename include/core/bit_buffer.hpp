@@ -0,0 +1,273 @@
+#pragma once
+#include "core/exception.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <type_traits>
+
+namespace core {
+
+/**
+ * Quantization of a floating point field on the bit-packed wire format. The
+ * value is sent as a signed integer multiple of the precision, on the given
+ * number of bits, between 1 and 63. Values outside of
+ * +/- precision * 2^(bits - 1) are clamped, the range has to cover the
+ * absolute values of the field. Zero is always exactly represented.
+ */
+struct Quantization {
+    float precision = 0.01f;
+    std::uint8_t bits = 16;
+};
+
+/**
+ * Writes values bit by bit (least significant bit first) in a growing byte
+ * buffer. Used by the bit-packed delta snapshot format.
+ */
+class BitWriter {
+public:
+    /**
+     * Writes the count lowest bits of the value.
+     * @param count, between 0 and 64.
+     */
+    void write_bits(std::uint64_t value, unsigned count)
+    {
+        while (count > 0) {
+            unsigned taken = std::min(count, 8u - _scratch_bits);
+            std::uint64_t mask = (std::uint64_t(1) << taken) - 1;
+            _scratch |=
+                static_cast<std::uint8_t>((value & mask) << _scratch_bits);
+            _scratch_bits += taken;
+            value >>= taken;
+            count -= taken;
+            if (_scratch_bits == 8) {
+                _buffer.push_back(static_cast<char>(_scratch));
+                _scratch = 0;
+                _scratch_bits = 0;
+            }
+        }
+    }
+
+    void write_bool(bool value)
+    {
+        write_bits(value ? 1 : 0, 1);
+    }
+
+    /**
+     * Writes an unsigned integer in groups of 7 bits followed by a
+     * continuation bit, small values take less space.
+     */
+    void write_varint(std::uint64_t value)
+    {
+        do {
+            write_bits(value & 0x7f, 7);
+            value >>= 7;
+            write_bool(value != 0);
+        } while (value != 0);
+    }
+
+    /**
+     * Writes a signed integer as a zigzag encoded varint.
+     */
+    void write_signed_varint(std::int64_t value)
+    {
+        write_varint((static_cast<std::uint64_t>(value) << 1)
+                     ^ static_cast<std::uint64_t>(value >> 63));
+    }
+
+    void write_bytes(void const* bytes, std::size_t size)
+    {
+        auto const* data = static_cast<std::uint8_t const*>(bytes);
+        for (std::size_t i = 0; i < size; i++) {
+            write_bits(data[i], 8);
+        }
+    }
+
+    /**
+     * Flushes the last partial byte and returns the buffer. The writer is
+     * empty afterwards.
+     */
+    std::string finish()
+    {
+        if (_scratch_bits > 0) {
+            _buffer.push_back(static_cast<char>(_scratch));
+            _scratch = 0;
+            _scratch_bits = 0;
+        }
+        return std::move(_buffer);
+    }
+
+    /**
+     * @return the number of bits written so far.
+     */
+    [[nodiscard]] std::size_t bit_count() const
+    {
+        return _buffer.size() * 8 + _scratch_bits;
+    }
+
+private:
+    std::string _buffer;
+    std::uint8_t _scratch = 0;
+    unsigned _scratch_bits = 0;
+};
+
+/**
+ * Reads the values written by a BitWriter.
+ */
+class BitReader {
+public:
+    BitReader(char const* data, std::size_t size)
+        : _data(reinterpret_cast<std::uint8_t const*>(data)), _size(size)
+    {
+    }
+
+    /**
+     * @throws BufferOverflowException if the buffer is too small.
+     */
+    std::uint64_t read_bits(unsigned count)
+    {
+        std::uint64_t value = 0;
+        unsigned read = 0;
+        while (read < count) {
+            if (_position >= _size) {
+                throw BufferOverflowException(
+                    "Read past the end of the buffer.");
+            }
+            unsigned taken = std::min(count - read, 8u - _bit_offset);
+            std::uint64_t bits = (_data[_position] >> _bit_offset)
+                                 & ((std::uint64_t(1) << taken) - 1);
+            value |= bits << read;
+            read += taken;
+            _bit_offset += taken;
+            if (_bit_offset == 8) {
+                _bit_offset = 0;
+                _position++;
+            }
+        }
+        return value;
+    }
+
+    bool read_bool()
+    {
+        return read_bits(1) != 0;
+    }
+
+    std::uint64_t read_varint()
+    {
+        std::uint64_t value = 0;
+        unsigned shift = 0;
+        bool more;
+        do {
+            if (shift >= 64) {
+                throw BufferOverflowException("Malformed varint.");
+            }
+            value |= read_bits(7) << shift;
+            shift += 7;
+            more = read_bool();
+        } while (more);
+        return value;
+    }
+
+    std::int64_t read_signed_varint()
+    {
+        auto value = read_varint();
+        return static_cast<std::int64_t>(value >> 1)
+               ^ -static_cast<std::int64_t>(value & 1);
+    }
+
+    void read_bytes(void* bytes, std::size_t size)
+    {
+        auto* data = static_cast<std::uint8_t*>(bytes);
+        for (std::size_t i = 0; i < size; i++) {
+            data[i] = static_cast<std::uint8_t>(read_bits(8));
+        }
+    }
+
+    /**
+     * @return the number of whole bytes left to read.
+     */
+    [[nodiscard]] std::size_t remaining() const
+    {
+        if (_position >= _size) {
+            return 0;
+        }
+        return ((_size - _position) * 8 - _bit_offset) / 8;
+    }
+
+    /**
+     * @return true if all the bytes have been read. The padding bits of the
+     * last byte are ignored.
+     */
+    [[nodiscard]] bool at_end() const
+    {
+        return _position >= _size
+               || (_position == _size - 1 && _bit_offset > 0);
+    }
+
+private:
+    std::uint8_t const* _data;
+    std::size_t _size;
+    std::size_t _position = 0;
+    unsigned _bit_offset = 0;
+};
+
+/**
+ * Packs a primitive value: quantized if it is a floating point value with a
+ * quantization, zigzag varint if it is an integer, raw bits otherwise.
+ */
+template <typename T>
+void pack_primitive(BitWriter& writer,
+                    T value,
+                    Quantization const* quantization)
+{
+    if constexpr (std::is_same<T, bool>::value) {
+        writer.write_bool(value);
+    }
+    else if constexpr (std::is_integral<T>::value) {
+        writer.write_signed_varint(static_cast<std::int64_t>(value));
+    }
+    else {
+        if (quantization != nullptr) {
+            auto limit = (std::int64_t(1) << (quantization->bits - 1)) - 1;
+            auto steps = static_cast<std::int64_t>(
+                std::llround(value / quantization->precision));
+            steps = std::max(-limit, std::min(limit, steps));
+            writer.write_bits(static_cast<std::uint64_t>(steps),
+                              quantization->bits);
+        }
+        else {
+            writer.write_bytes(&value, sizeof(T));
+        }
+    }
+}
+
+/**
+ * Unpacks a primitive value written by pack_primitive().
+ */
+template <typename T>
+T unpack_primitive(BitReader& reader, Quantization const* quantization)
+{
+    if constexpr (std::is_same<T, bool>::value) {
+        return reader.read_bool();
+    }
+    else if constexpr (std::is_integral<T>::value) {
+        return static_cast<T>(reader.read_signed_varint());
+    }
+    else {
+        if (quantization != nullptr) {
+            auto bits = reader.read_bits(quantization->bits);
+            // sign extension of the quantization->bits wide integer
+            auto sign_bit = std::uint64_t(1) << (quantization->bits - 1);
+            auto steps = static_cast<std::int64_t>((bits ^ sign_bit))
+                         - static_cast<std::int64_t>(sign_bit);
+            return static_cast<T>(steps * quantization->precision);
+        }
+        T value;
+        reader.read_bytes(&value, sizeof(T));
+        return value;
+    }
+}
+
+} // namespace core
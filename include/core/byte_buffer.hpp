@@ -0,0 +1,127 @@
+#pragma once
+#include "core/exception.hpp"
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+namespace core {
+
+/**
+ * Cursor writing fixed-layout binary data directly into a caller-provided
+ * buffer. Values are copied with their in-memory representation, no stream
+ * nor intermediate string is involved.
+ */
+class ByteWriter {
+public:
+    ByteWriter(std::uint8_t* data, std::size_t size) : _data(data), _size(size)
+    {
+    }
+
+    ByteWriter(char* data, std::size_t size)
+        : ByteWriter(reinterpret_cast<std::uint8_t*>(data), size)
+    {
+    }
+
+    /**
+     * Writes a trivially copyable value at the cursor position.
+     * @throws BufferOverflowException if the buffer is too small.
+     */
+    template <typename T>
+    void write(T const& value)
+    {
+        static_assert(std::is_trivially_copyable<T>::value,
+                      "Only trivially copyable values can be written.");
+        write_bytes(&value, sizeof(T));
+    }
+
+    /**
+     * Writes raw bytes at the cursor position.
+     * @throws BufferOverflowException if the buffer is too small.
+     */
+    void write_bytes(void const* bytes, std::size_t size)
+    {
+        if (size > remaining()) {
+            throw BufferOverflowException("Write past the end of the buffer.");
+        }
+        std::memcpy(_data + _position, bytes, size);
+        _position += size;
+    }
+
+    /**
+     * @return the number of bytes written so far.
+     */
+    [[nodiscard]] std::size_t position() const
+    {
+        return _position;
+    }
+
+    [[nodiscard]] std::size_t remaining() const
+    {
+        return _size - _position;
+    }
+
+private:
+    std::uint8_t* _data;
+    std::size_t _size;
+    std::size_t _position = 0;
+};
+
+/**
+ * Cursor reading fixed-layout binary data written by a ByteWriter.
+ */
+class ByteReader {
+public:
+    ByteReader(std::uint8_t const* data, std::size_t size)
+        : _data(data), _size(size)
+    {
+    }
+
+    ByteReader(char const* data, std::size_t size)
+        : ByteReader(reinterpret_cast<std::uint8_t const*>(data), size)
+    {
+    }
+
+    /**
+     * Reads a trivially copyable value at the cursor position.
+     * @throws BufferOverflowException if the buffer is too small.
+     */
+    template <typename T>
+    T read()
+    {
+        static_assert(std::is_trivially_copyable<T>::value,
+                      "Only trivially copyable values can be read.");
+        T value;
+        read_bytes(&value, sizeof(T));
+        return value;
+    }
+
+    /**
+     * Reads raw bytes at the cursor position.
+     * @throws BufferOverflowException if the buffer is too small.
+     */
+    void read_bytes(void* bytes, std::size_t size)
+    {
+        if (size > remaining()) {
+            throw BufferOverflowException("Read past the end of the buffer.");
+        }
+        std::memcpy(bytes, _data + _position, size);
+        _position += size;
+    }
+
+    [[nodiscard]] std::size_t position() const
+    {
+        return _position;
+    }
+
+    [[nodiscard]] std::size_t remaining() const
+    {
+        return _size - _position;
+    }
+
+private:
+    std::uint8_t const* _data;
+    std::size_t _size;
+    std::size_t _position = 0;
+};
+
+} // namespace core
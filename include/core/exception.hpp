@@ -61,6 +61,47 @@ private:
     std::string _type;
 };
 
+class UnknownFieldException : public core::HarakaException {
+public:
+    UnknownFieldException(std::string const& message, std::string const& field)
+        : core::HarakaException(message), _field(field)
+    {
+    }
+
+    [[nodiscard]] std::string field()
+    {
+        return _field;
+    }
+
+private:
+    std::string _field;
+};
+
+class InvalidQuantizationException : public core::HarakaException {
+public:
+    InvalidQuantizationException(std::string const& message,
+                                 std::string const& field)
+        : core::HarakaException(message), _field(field)
+    {
+    }
+
+    [[nodiscard]] std::string field()
+    {
+        return _field;
+    }
+
+private:
+    std::string _field;
+};
+
+class BufferOverflowException : public core::HarakaException {
+public:
+    BufferOverflowException(std::string const& message)
+        : core::HarakaException(message)
+    {
+    }
+};
+
 class UnknownClassConstructorException : public core::HarakaException {
 public:
     UnknownClassConstructorException(std::string const& message)
@@ -2,8 +2,10 @@
 #include "core/events.hpp"
 #include "core/serialization/object_serialization.pb.h"
 #include "core/types.hpp"
+#include "core/value_schema.hpp"
 #include <map>
 #include <memory>
+#include <memory_resource>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -11,10 +13,14 @@
 namespace core {
 
 /**
- * Set of differences between two similar objects. The std::string is the name
- * while the std::shared_ptr<GameValue> (core::value_t) is the delta value.
+ * Set of differences between two similar objects. Fields are addressed by
+ * their index in the object schema while the core::value_t (ValueBox) is the
+ * delta value.
  */
-typedef std::map<std::string, core::value_t> diffset_t;
+typedef DiffSet diffset_t;
+
+// forward declaration
+class Snapshot;
 
 /**
  * Abstract class that consist of all entities and attributes.
@@ -26,6 +32,11 @@ public:
     typedef std::unique_ptr<GameObject> (*base_creator_fn)();
     typedef std::unordered_map<std::string, base_creator_fn> registry_map;
 
+    /**
+     * Longest type name accepted by unpack().
+     */
+    static constexpr std::size_t max_type_name_size = 256;
+
     GameObject(std::uint32_t id);
 
     /**
@@ -57,6 +68,20 @@ public:
      */
     virtual void update(float delta_time) = 0;
 
+    /**
+     * Updates the object during a parallel snapshot update, see
+     * Snapshot::update(). The objects are updated concurrently, so this
+     * method must only mutate the object itself. Other objects are read from
+     * the previous snapshot, which stays unchanged during the whole update.
+     * Calls update(delta_time) by default.
+     * @param delta_time
+     * @param previous, the snapshot the updated one was copied from.
+     */
+    virtual void update(float delta_time, Snapshot const& /*previous*/)
+    {
+        update(delta_time);
+    }
+
     /**
      * @return an unique pointer to a deepcopy of this game object.
      */
@@ -67,6 +92,18 @@ public:
      */
     virtual std::string type_name() const = 0;
 
+    /**
+     * Static objects are never updated by the snapshots, which lets them be
+     * shared between consecutive snapshots without being cloned, and keeps
+     * them out of the delta evaluation. They are still cloned if an action
+     * mutates them. The other objects are compared at every tick.
+     * @return true if update() doesn't need to be called on this object.
+     */
+    virtual bool is_static() const
+    {
+        return false;
+    }
+
     /**
      * Computes the object checksum by performing exclusive or operations on
      * each object game value checksum. This can be used to check wherever the
@@ -79,33 +116,92 @@ public:
     /**
      * Iterates over all the mapped GameValues and get the delta values by
      * comparing with the other GameObject. Returns a list of those delta values
-     * with the corresponding variable name.
+     * with the corresponding variable name, the zero deltas of the unchanged
+     * values are left out.
      *
      * @param other, the other object to compare with.
+     * @param resource, allocates the delta values, a per-tick arena when
+     * evaluating a delta snapshot.
      * @return a list of delta values.
      */
-    diffset_t compare(GameObject const* other) const;
+    diffset_t compare(GameObject const* other,
+                      std::pmr::memory_resource* resource =
+                          std::pmr::get_default_resource()) const;
 
     /**
-     * Returns an object's game value.
+     * Returns an object's game value from its name. Prefer the field index
+     * version outside of debugging.
      * @param name, the name of the value
      * @return a game value.
      */
     [[nodiscard]] GameValue const* get_value(std::string const& name) const;
 
+    /**
+     * Returns an object's game value.
+     * @param field, the index of the value in the object schema.
+     * @return a game value.
+     */
+    [[nodiscard]] GameValue const* get_value(field_id_t field) const;
+
+    /**
+     * @return the schema the object values are bound to, nullptr if the
+     * values are not bound yet.
+     */
+    [[nodiscard]] ValueSchema const* schema() const;
+
     /**
      * @return the object's id in the game
      */
     [[nodiscard]] std::uint32_t id() const;
 
+    /**
+     * @return the size in bytes of all the object values binary
+     * representation.
+     */
+    [[nodiscard]] std::size_t values_byte_size() const;
+
+    /**
+     * Writes all the object values in schema order, using their binary
+     * representation.
+     */
+    void write_values(ByteWriter& writer) const;
+
+    /**
+     * Reads all the object values in place, in schema order.
+     */
+    void read_values(ByteReader& reader);
+
+    /**
+     * Writes the object type name and its values on the bit-packed wire
+     * format, with full precision. The id is not written.
+     */
+    void pack(BitWriter& writer) const;
+
+    /**
+     * Reads an object written by pack().
+     * @param id, the id of the object.
+     * @return the new object.
+     * @throws BufferOverflowException if the type name length is larger
+     * than the remaining bytes or max_type_name_size.
+     */
+    static std::unique_ptr<GameObject> unpack(BitReader& reader,
+                                              std::uint32_t id);
+
     /**
      * Serializes the object, returning a serialization object defined by
      * protocol buffers. This object contains the object id, object type id
-     * (from factory) and all the GameValues serialized.
+     * (from factory) and all the GameValues packed in binary.
      * @return a serialization object.
      */
     serialization::GameObject serialize() const;
 
+    /**
+     * Serializes the object in place, in a message usually added to a
+     * snapshot message, which saves the copy of serialize().
+     * @param object, the message to fill.
+     */
+    void serialize_to(serialization::GameObject* object) const;
+
     /**
      * Deserializes an object, reading the tick value and all the gameobject
      * info.
@@ -131,12 +227,18 @@ public:
 
 protected:
     /**
-     * Adds a pointer to the _values map for each member value.
+     * Binds a pointer to each member value in the _values table, following
+     * the type schema order.
      * ALWAYS CALL IT IN THE SUBCLASS CONSTRUCTORS
      */
     virtual void add_values() = 0;
 
-    std::map<std::string, GameValue*> _values;
+    /**
+     * Pointers to the object game values, indexed by schema field. The values
+     * are either members of the derived object or slots of a ValueColumn (see
+     * core/value_column.hpp) when the type uses column storage.
+     */
+    ValueTable _values;
 
     std::uint32_t _id = 0;
 };
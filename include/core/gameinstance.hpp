@@ -4,8 +4,10 @@
 #include "core/events.hpp"
 #include "core/player.hpp"
 #include "core/snapshot.hpp"
-#include "util/tsdeque.hpp"
-#include <deque>
+#include "core/snapshot_history.hpp"
+#include "util/arena.hpp"
+#include "util/ring_queue.hpp"
+#include <memory>
 #include <vector>
 
 namespace core {
@@ -25,20 +27,28 @@ public:
      * @param snapshot, base game state can be empty
      * @param server_side, is this instance running on a server? boolean flag
      * @param tick_rate, number of tick simulation per second
+     * @param history_size, number of past snapshots kept, used as delta
+     * baselines.
+     * @param keyframe_interval, number of ticks between two keyframes kept
+     * beyond the history, 0 to disable them.
      */
     GameInstance(core::Snapshot const snapshot,
                  bool server_side = false,
-                 std::uint32_t tick_rate = 15);
+                 std::uint32_t tick_rate = 15,
+                 std::size_t history_size = 32,
+                 std::uint32_t keyframe_interval = 0);
 
     /**
      * Adds an action to the action list. This action will be used in the next
-     * tick simulation.
+     * tick simulation. Can be called from any thread.
      * @param action, pointer to a GameAction
+     * @return false if the action queue is full, the action is then dropped.
      */
-    void add_action(std::shared_ptr<core::GameAction> action);
+    bool add_action(std::shared_ptr<core::GameAction> action);
 
     /**
-     * Makes a copy of the action queue in a vector and returns it.
+     * @return the actions played during the last tick, in the same order as
+     * action_status_list().
      */
     std::vector<std::shared_ptr<core::GameAction>> action_list();
 
@@ -58,6 +68,28 @@ public:
      */
     [[nodiscard]] core::Snapshot const& current_snapshot() const;
 
+    /**
+     * Returns the snapshot of a given tick, if it is still kept in the
+     * history. Snapshots share their unchanged objects, so keeping them is
+     * cheap.
+     * @param tick, the tick of the snapshot.
+     * @return a pointer to the snapshot or nullptr if it is not available.
+     */
+    [[nodiscard]] core::Snapshot const* snapshot_at(std::uint32_t tick) const;
+
+    /**
+     * @return the history of the past snapshots and their delta snapshots.
+     */
+    [[nodiscard]] core::SnapshotHistory const& history() const;
+
+    /**
+     * Sets the worker pool used to update the snapshot objects and evaluate
+     * the delta snapshots in parallel, see Snapshot::update(). Everything
+     * runs on the ticking thread when there is none.
+     * @param pool, the worker pool, must outlive the instance, or nullptr.
+     */
+    void set_worker_pool(util::ThreadPool* pool);
+
 private:
     /**
      * Executes an action, performing a change on the game state or return false
@@ -75,10 +107,21 @@ private:
      */
     void _initialize();
 
+    /**
+     * Returns an arena held by no delta snapshot anymore, reset, or a new
+     * one if they are all in use.
+     */
+    std::shared_ptr<util::Arena> _acquire_delta_arena();
+
     /**
      * The actions waiting to be used in the next snapshot
      */
-    util::ThreadSafeDeque<std::shared_ptr<GameAction>> _action_queue;
+    util::MPSCRingQueue<std::shared_ptr<GameAction>> _action_queue{1024};
+
+    /**
+     * The actions played during the last tick.
+     */
+    std::vector<std::shared_ptr<GameAction>> _played_actions;
 
     /**
      * Contains reports of the action status that where used when computing the
@@ -112,9 +155,27 @@ private:
     Snapshot _current_snapshot;
 
     /**
-     * A double access queue containing all the delta snapshots of the game.
+     * The most recent past snapshots with the delta snapshots evaluated from
+     * them, bounded in size.
+     */
+    SnapshotHistory _history;
+
+    /**
+     * Pool updating the objects in parallel, nullptr if none.
+     */
+    util::ThreadPool* _worker_pool = nullptr;
+
+    /**
+     * Arenas of the evaluated delta snapshots. A delta snapshot keeps its
+     * arena as long as it is in the history (or held elsewhere), then the
+     * arena is reused for a new tick.
+     */
+    std::vector<std::shared_ptr<util::Arena>> _delta_arenas;
+
+    /**
+     * Index of the arena the next search starts from.
      */
-    std::deque<std::shared_ptr<DeltaSnapshot>> _delta_snapshots;
+    std::size_t _next_delta_arena = 0;
 };
 
 } // namespace core
@@ -1,7 +1,10 @@
 #pragma once
 #include "core/game_object.hpp"
 #include "core/serialization/object_serialization.pb.h"
-#include <map>
+#include "util/arena.hpp"
+#include "util/flat_map.hpp"
+#include "util/thread_pool.hpp"
+#include <optional>
 
 namespace core {
 
@@ -10,14 +13,37 @@ namespace core {
  *
  * std::uint32_t is the id of the object in the snapshot.
  * std::string is the name of the variables
- * core::value_t is the delta difference.
+ * core::value_t is the delta difference, stored by value.
  */
-typedef std::map<std::uint32_t, diffset_t> diffmap_t;
+typedef util::FlatMap<diffset_t> diffmap_t;
 
-typedef std::map<std::uint32_t, std::shared_ptr<GameObject>> object_map_t;
+typedef util::FlatMap<std::shared_ptr<GameObject>> object_map_t;
 
 typedef std::vector<std::uint32_t> id_list_t;
 
+/**
+ * Object slot of a snapshot. Objects are shared between a snapshot and its
+ * copies until one of them needs to mutate it (copy-on-write), this way the
+ * objects which are neither updated nor modified by an action (the static
+ * objects) are never cloned between two ticks.
+ */
+struct SnapshotEntry {
+    std::shared_ptr<GameObject> object;
+
+    /**
+     * True if the object can be mutated in place by the snapshot, false if it
+     * might be shared with another snapshot. Mutable as copying a snapshot also
+     * gives up the ownership on the source snapshot's objects.
+     */
+    mutable bool owned = true;
+};
+
+/**
+ * Objects of a snapshot, sorted by id and stored contiguously: copying a
+ * snapshot is a single allocation and the updates walk packed entries.
+ */
+typedef util::FlatMap<SnapshotEntry> entry_map_t;
+
 // forward declaration
 class DeltaSnapshot;
 
@@ -31,17 +57,56 @@ public:
     Snapshot(std::uint32_t tick);
 
     /**
-     * Copy constructor. Will copy all the data in the object. The tick is by
+     * Copy constructor. The objects are shared with the other snapshot and are
+     * only cloned when one of the two snapshots mutates them. The tick is by
      * default incremented by one.
      */
     Snapshot(Snapshot const& other);
 
+    Snapshot(Snapshot&& other) = default;
+
+    /**
+     * Copy assignment, shares the objects the same way as the copy
+     * constructor but keeps the tick of the other snapshot.
+     */
+    Snapshot& operator=(Snapshot const& other);
+
+    Snapshot& operator=(Snapshot&& other) = default;
+
     /**
-     * Simulates all the game physics
+     * Simulates all the game physics. Static objects are skipped and stay
+     * shared with the previous snapshot.
+     *
+     * The other objects are cloned if shared and marked as dirty, whether
+     * their update changes them or not: the writes to the values are not
+     * tracked, so the next delta evaluation compares all of them. Only the
+     * static objects are left out of the comparison.
      * @param delta_time, the time between the two snapshots.
      */
     void update(float delta_time);
 
+    /**
+     * Parallel version of update(). The objects to update are split in chunks
+     * run on the worker pool, each object being updated with
+     * GameObject::update(delta_time, previous).
+     *
+     * Read contract: an object only mutates itself during its update and
+     * reads the other objects from the previous snapshot (double-buffered
+     * reads). The objects of this snapshot are not consistent until the
+     * update returns. Objects still shared with the previous snapshot are
+     * cloned before their update, so the previous snapshot is never mutated.
+     * As with update(), every updated object is marked as dirty.
+     *
+     * @param delta_time, the time between the two snapshots.
+     * @param previous, the snapshot this one was copied from.
+     * @param pool, the worker pool running the updates.
+     * @param chunk_size, number of consecutive objects updated by a task.
+     */
+    void update(float delta_time,
+                Snapshot const& previous,
+                util::ThreadPool& pool,
+                std::size_t chunk_size = 64);
+
     /**
      * Applies a delta snapshot, creating a new (interpolated) snapshot.
      * @param delta, the delta snapshot
@@ -73,7 +138,8 @@ public:
 
     /**
      * Returns the game object pointer by id. Returns nullptr if no object has
-     * been found.
+     * been found. As the returned object may be mutated, it is cloned first if
+     * it is still shared with another snapshot.
      * @return pointer to object if found, nullptr if not found.
      */
     std::shared_ptr<GameObject> get_object(std::uint32_t id);
@@ -98,10 +164,65 @@ public:
      */
     serialization::Snapshot serialize() const;
 
+    /**
+     * Serializes the snapshot in place. The object messages are built in the
+     * snapshot message directly, allocated on its arena if it has one.
+     * @param snapshot, the message to fill, usually created on a
+     * google::protobuf::Arena reused across the ticks.
+     */
+    void serialize_to(serialization::Snapshot* snapshot) const;
+
 private:
-    std::map<std::uint32_t, std::shared_ptr<GameObject>> _objects;
+    /**
+     * Makes sure the entry's object is owned by this snapshot, cloning it if
+     * it is still shared. Marks the object as dirty.
+     * @return the object, that can be safely mutated.
+     */
+    std::shared_ptr<GameObject> const& _own(std::uint32_t id,
+                                            SnapshotEntry& entry);
+
+    /**
+     * Records that the object may have changed (or has been added or deleted)
+     * since this snapshot was copied.
+     */
+    void _mark_dirty(std::uint32_t id);
+
+    /**
+     * Returns true if this snapshot is an unmodified parent of the other
+     * snapshot, meaning that the dirty objects of the other snapshot are the
+     * only possible differences between the two.
+     */
+    bool _is_parent_of(Snapshot const& other) const;
+
+    entry_map_t _objects;
 
     std::uint32_t _tick;
+
+    /**
+     * Unique identifier of the snapshot, used to recognize its copies.
+     */
+    std::uint64_t _uid;
+
+    /**
+     * Identifier of the snapshot this one has been copied from, 0 if none.
+     */
+    std::uint64_t _parent_uid = 0;
+
+    /**
+     * Number of tracked modifications of the snapshot.
+     */
+    std::uint64_t _revision = 0;
+
+    /**
+     * Revision of the parent snapshot when it has been copied.
+     */
+    std::uint64_t _parent_revision = 0;
+
+    /**
+     * Ids of the objects mutated, added or deleted since the copy. May
+     * contain duplicates.
+     */
+    std::vector<std::uint32_t> _dirty_objects;
 };
 
 /**
@@ -110,7 +231,24 @@ private:
  */
 class DeltaSnapshot : std::enable_shared_from_this<DeltaSnapshot> {
 public:
-    DeltaSnapshot(std::uint32_t prev_tick, std::uint32_t next_tick);
+    /**
+     * @param resource, allocates the differences and the maps, a per-tick
+     * arena for the deltas discarded at the end of the tick. It must outlive
+     * the delta snapshot, and be thread-safe for the parallel evaluate().
+     */
+    DeltaSnapshot(std::uint32_t prev_tick,
+                  std::uint32_t next_tick,
+                  std::pmr::memory_resource* resource =
+                      std::pmr::get_default_resource());
+
+    /**
+     * Allocates from an arena kept alive by the delta snapshot, for the
+     * deltas kept longer than a tick. The arena can be reset and reused once
+     * no delta snapshot holds it anymore.
+     */
+    DeltaSnapshot(std::uint32_t prev_tick,
+                  std::uint32_t next_tick,
+                  std::shared_ptr<util::Arena> arena);
 
     /**
      * Move constructor, as it is moved away to the heap in order to be used as
@@ -121,8 +259,45 @@ public:
     /**
      * Builds the _delta_values map by comparing each object of the two
      * snapshots.
+     *
+     * If the next snapshot is a copy of the (unmodified) previous snapshot,
+     * only the objects marked as dirty since the copy are visited: the
+     * objects added, deleted, updated or taken mutably. Otherwise,
+     * or if verify is true, all the objects are visited and their checksums
+     * compared.
+     * @param verify, forces the full checksum comparison.
      */
-    void evaluate(Snapshot const& prev_snap, Snapshot const& next_snap);
+    void evaluate(Snapshot const& prev_snap,
+                  Snapshot const& next_snap,
+                  bool verify = false);
+
+    /**
+     * Parallel version of evaluate(). The object ids are split in ranges of
+     * about parallel_chunk_size objects, each range is compared on the
+     * worker pool into its own buffers, which are merged at the end.
+     * @param pool, the worker pool comparing the ranges.
+     * @param verify, forces the full checksum comparison.
+     */
+    void evaluate(Snapshot const& prev_snap,
+                  Snapshot const& next_snap,
+                  util::ThreadPool& pool,
+                  bool verify = false);
+
+    /**
+     * @return the tick of the snapshot the delta applies to.
+     */
+    std::uint32_t prev_tick() const
+    {
+        return _prev_tick;
+    }
+
+    /**
+     * @return the tick of the snapshot the delta leads to.
+     */
+    std::uint32_t next_tick() const
+    {
+        return _next_tick;
+    }
 
     /**
      * Returns the evaluated differences between two snapshot.
@@ -159,10 +334,151 @@ public:
      */
     serialization::DeltaSnapshot serialize() const;
 
+    /**
+     * Parallel version of serialize(), the objects are serialized on the
+     * worker pool.
+     * @param pool, the worker pool serializing the objects.
+     * @return a protobuf DeltaSnapshot packet.
+     */
+    serialization::DeltaSnapshot serialize(util::ThreadPool& pool) const;
+
+    /**
+     * Serializes the delta snapshot in place, building the sub-messages in
+     * the message directly (on its arena if it has one).
+     * @param delta_snapshot, the message to fill.
+     */
+    void serialize_to(serialization::DeltaSnapshot* delta_snapshot) const;
+
+    /**
+     * Parallel version of serialize_to(). The sub-messages are added first,
+     * then filled by the worker pool.
+     * @param delta_snapshot, the message to fill.
+     * @param pool, the worker pool serializing the objects.
+     */
+    void serialize_to(serialization::DeltaSnapshot* delta_snapshot,
+                      util::ThreadPool& pool) const;
+
+    /**
+     * Number of objects compared or serialized by a task of the parallel
+     * versions.
+     */
+    static constexpr std::size_t parallel_chunk_size = 256;
+
+    /**
+     * Serializes the delta snapshot on the compact bit-packed wire format:
+     * varint (delta coded) object ids, a field bitmask per object instead of
+     * the field names, and quantized values for the fields declaring a
+     * quantization in their schema. Zero delta values are not sent.
+     *
+     * The quantized fields are sent as their absolute value in the next
+     * snapshot, turned back into a delta by the receiver: the quantization
+     * error stays within the precision instead of accumulating over the
+     * deltas.
+     * @param next_snapshot, the snapshot the delta leads to, gives the
+     * absolute values of the quantized fields.
+     * @return the packed bytes.
+     */
+    std::string serialize_packed(Snapshot const& next_snapshot) const;
+
+    /**
+     * Deserializes a delta snapshot written by serialize_packed().
+     * @param bytes, the packed bytes.
+     * @param reference_snapshot, the snapshot the delta applies to, gives the
+     * type of each object and the base of the quantized absolute values.
+     * @return the parsed DeltaSnapshot.
+     */
+    static DeltaSnapshot
+    deserialize_packed(std::string const& bytes,
+                       core::Snapshot const& reference_snapshot);
+
 private:
+    /**
+     * Differences found in a range of object ids, in id order.
+     */
+    struct DeltaRange {
+        explicit DeltaRange(std::pmr::memory_resource* resource)
+            : delta_values(resource),
+              deleted_objects(resource),
+              added_objects(resource)
+        {
+        }
+
+        std::pmr::vector<std::pair<std::uint32_t, diffset_t>> delta_values;
+
+        std::pmr::vector<std::uint32_t> deleted_objects;
+
+        std::pmr::vector<
+            std::pair<std::uint32_t, std::shared_ptr<GameObject>>>
+            added_objects;
+    };
+
+    /**
+     * @return one empty range per chunk, allocated from the resource.
+     */
+    std::pmr::vector<DeltaRange> _make_ranges(std::size_t count) const;
+
+    /**
+     * Compares every object of the two snapshots, walking the two id-sorted
+     * object maps at once.
+     * @param pool, splits the walk in ranges compared in parallel if not
+     * nullptr.
+     */
+    void _evaluate_all(Snapshot const& prev_snap,
+                       Snapshot const& next_snap,
+                       util::ThreadPool* pool);
+
+    /**
+     * Only compares the objects that are dirty in the next snapshot.
+     * @param pool, compares the dirty objects in parallel if not nullptr.
+     */
+    void _evaluate_dirty(Snapshot const& prev_snap,
+                         Snapshot const& next_snap,
+                         util::ThreadPool* pool);
+
+    /**
+     * Merge-walks the objects of the two snapshots with an id in
+     * [first_id, last_id), last_id excluded unless it is the end of the ids.
+     */
+    static void _evaluate_range(Snapshot const& prev_snap,
+                                Snapshot const& next_snap,
+                                std::uint32_t first_id,
+                                std::optional<std::uint32_t> last_id,
+                                DeltaRange& range);
+
+    /**
+     * Compares an object in the two snapshots, nullptr meaning the object is
+     * not in the snapshot.
+     * @param checksum, compares the objects only if their checksums differ.
+     */
+    static void _compare_object(std::uint32_t object_id,
+                                std::shared_ptr<GameObject> const* prev_object,
+                                std::shared_ptr<GameObject> const* next_object,
+                                bool checksum,
+                                DeltaRange& range);
+
+    /**
+     * Appends the differences of the ranges, in order.
+     */
+    void _merge_ranges(std::pmr::vector<DeltaRange>& ranges);
+
+    /**
+     * Serializes the differences of an object, as (field index, value) pairs
+     * written directly in the message buffer.
+     */
+    static void _serialize_differences(diffset_t const& differences,
+                                       serialization::ValueMap* value_map);
+
     std::uint32_t _prev_tick = 0;
     std::uint32_t _next_tick = 0;
 
+    /**
+     * Arena owned by the delta snapshot, if any. Declared before the maps so
+     * that it is destroyed after them.
+     */
+    std::shared_ptr<util::Arena> _arena;
+
+    std::pmr::memory_resource* _resource;
+
     /** The key is the game object id, the Gamevalue is a state change */
     diffmap_t _delta_values;
 
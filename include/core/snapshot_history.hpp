@@ -0,0 +1,110 @@
+#pragma once
+#include "core/snapshot.hpp"
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <vector>
+
+namespace core {
+
+/**
+ * Fixed capacity history of the recent snapshots of a game instance, along
+ * with the delta snapshot evaluated from each of them. Used as baselines for
+ * client deltas, for late joins and for rewinds.
+ *
+ * Snapshots are stored in a ring buffer indexed by tick, so lookups are O(1)
+ * and memory stays bounded however long the game runs. Snapshots share their
+ * unchanged objects, so a slot only costs the objects modified at its tick.
+ *
+ * Every keyframe_interval ticks the snapshot is also kept as a keyframe, in a
+ * second, smaller ring. Keyframes reach further in the past than the history
+ * at a coarser granularity.
+ */
+class SnapshotHistory {
+public:
+    /**
+     * @param capacity, number of consecutive ticks kept.
+     * @param keyframe_interval, number of ticks between two keyframes, 0 to
+     * disable keyframes.
+     * @param keyframe_capacity, number of keyframes kept.
+     */
+    explicit SnapshotHistory(std::size_t capacity = 64,
+                             std::uint32_t keyframe_interval = 0,
+                             std::size_t keyframe_capacity = 8);
+
+    /**
+     * Adds a snapshot to the history, overwriting the oldest one when full.
+     * Snapshots are expected to be pushed in increasing tick order.
+     * @param snapshot, the snapshot to keep.
+     * @param delta, the delta snapshot evaluated from this snapshot to the
+     * next one, may be nullptr.
+     */
+    void push(Snapshot&& snapshot, std::shared_ptr<DeltaSnapshot> delta);
+
+    /**
+     * Returns the snapshot of a tick, from the history or from the keyframes.
+     * @param tick, the tick of the snapshot.
+     * @return a pointer to the snapshot, nullptr if it is not kept.
+     */
+    [[nodiscard]] Snapshot const* snapshot_at(std::uint32_t tick) const;
+
+    /**
+     * Returns the delta snapshot evaluated from a tick to the next one.
+     * @param tick, the tick the delta starts from.
+     * @return the delta snapshot, nullptr if it is not kept.
+     */
+    [[nodiscard]] std::shared_ptr<DeltaSnapshot>
+    delta_from(std::uint32_t tick) const;
+
+    /**
+     * Returns the most recent keyframe at or before a tick.
+     * @param tick, the tick to look from.
+     * @return a pointer to the keyframe, nullptr if there is none.
+     */
+    [[nodiscard]] Snapshot const* keyframe_before(std::uint32_t tick) const;
+
+    /**
+     * @return the number of ticks covered by the history (keyframes
+     * excluded). Skipped ticks are counted but have no snapshot.
+     */
+    [[nodiscard]] std::size_t size() const;
+
+    /**
+     * @return the maximum number of snapshots in the history.
+     */
+    [[nodiscard]] std::size_t capacity() const;
+
+    /**
+     * @return true if no snapshot has been pushed yet.
+     */
+    [[nodiscard]] bool empty() const;
+
+    /**
+     * @return the tick of the oldest snapshot in the history.
+     */
+    [[nodiscard]] std::uint32_t oldest_tick() const;
+
+    /**
+     * @return the tick of the most recent snapshot in the history.
+     */
+    [[nodiscard]] std::uint32_t latest_tick() const;
+
+private:
+    struct Slot {
+        std::optional<Snapshot> snapshot;
+
+        std::shared_ptr<DeltaSnapshot> delta;
+    };
+
+    std::vector<Slot> _slots;
+
+    std::vector<std::optional<Snapshot>> _keyframes;
+
+    const std::uint32_t _keyframe_interval;
+
+    std::size_t _size = 0;
+
+    std::uint32_t _latest_tick = 0;
+};
+
+} // namespace core
@@ -1,16 +1,25 @@
 #pragma once
+#include "core/bit_buffer.hpp"
+#include "core/byte_buffer.hpp"
 #include <assert.h>
+#include <cstddef>
 #include <memory>
 #include <boost/crc.hpp>
-#include <sstream>
+#include <new>
+#include <type_traits>
+#include <string>
 
 namespace core {
 
+class ValueBox;
+
 /**
  * Base abstract class for all the Game object values.
  */
 class GameValue : public std::enable_shared_from_this<GameValue> {
 public:
+    virtual ~GameValue() = default;
+
     /**
      * Returns the checksum of the object from it's value with the CRC hashing
      * algorithm.
@@ -20,65 +29,116 @@ public:
 
     /**
      * Takes the values of the given GameValues and copies it to this game
-     * values. This is a kind of copy assignment but supports polymorphism
+     * values. This is a kind of copy assignment but supports polymorphism.
+     * The other value must be of the same type.
      *
      * @param other
      */
-    virtual void change(std::shared_ptr<GameValue>& other) = 0;
+    virtual void change(GameValue const& other) = 0;
 
     /**
      * Computes the difference between the two GameValues and stores it in a
      * GameValue
      * @param new_value, the more recent GameValue.
+     * @return the delta value, stored in place in the returned box.
      */
-    virtual std::shared_ptr<GameValue> get_delta(GameValue* new_value) = 0;
+    virtual ValueBox get_delta(GameValue const* new_value) const = 0;
 
     /**
      * Interpolates the delta
      * @param delta, the delta delta to the next snapshot.
      * @param interval, between 0.0 and 1.0 where to linearly interpolate in
      * time.
-     * @return
+     * @return the interpolated value, stored in place in the returned box.
+     */
+    virtual ValueBox interp(GameValue const* delta, float interval) const = 0;
+
+    /**
+     * Copies this value in the box, keeping its dynamic type.
+     * @param box, the box to copy the value to.
+     */
+    virtual void copy_to(ValueBox& box) const = 0;
+
+    /**
+     * @return the size in bytes of the binary representation of the value.
      */
-    virtual std::shared_ptr<GameValue> interp(GameValue* delta,
-                                              float interval) = 0;
+    virtual std::size_t byte_size() const = 0;
+
+    /**
+     * Writes the binary representation of the value at the writer position.
+     */
+    virtual void write(ByteWriter& writer) const = 0;
+
+    /**
+     * Reads the value in place from its binary representation.
+     */
+    virtual void read(ByteReader& reader) = 0;
+
+    /**
+     * Writes the value on the bit-packed wire format. The default
+     * implementation writes the binary representation as is.
+     * @param quantization, the field quantization or nullptr.
+     */
+    virtual void pack(BitWriter& writer,
+                      Quantization const* quantization) const;
+
+    /**
+     * Reads the value in place from the bit-packed wire format.
+     * @param quantization, the field quantization or nullptr.
+     */
+    virtual void unpack(BitReader& reader, Quantization const* quantization);
+
+    /**
+     * Used on delta values to skip the unchanged fields when packing.
+     * @return true if the value is the neutral (zero) value.
+     */
+    virtual bool is_zero() const
+    {
+        return false;
+    }
 
     /**
      * Serializes the game value into a string. This will be put in a protocol
      * buffer.
      * @return, the serialized value in bytes.
      */
-    virtual std::string serialize() const = 0;
+    std::string serialize() const
+    {
+        std::string bytes(byte_size(), '\0');
+        ByteWriter writer(bytes.data(), bytes.size());
+        write(writer);
+        return bytes;
+    }
 
     /**
-     * Deserializes a string into a game value. This class is obviously polymorphic
-     * and it is assumed as the right derived class object is used to parse this
-     * string.
-     * @return a shared pointer to a newly created game value.
+     * Deserializes a string into a game value. This class is obviously
+     * polymorphic and it is assumed as the right derived class object is used
+     * to parse this string.
+     * @return a box containing the deserialized game value.
      */
-    virtual std::shared_ptr<GameValue> deserialize(std::string const& bytes) const = 0;
+    ValueBox deserialize(std::string const& bytes) const;
 
     /**
-     * Dynamically casts the game value in the specified derived GameValue
-     * class.
+     * Casts the game value in the specified derived GameValue class. The
+     * type is only checked in debug builds.
      * @tparam T
-     * @return the dynamically casted GameValue.
+     * @return the casted GameValue.
      */
     template <typename T,
               typename = typename std::enable_if<
                   std::is_base_of<GameValue, T>::value>::type>
     T* cast()
     {
-        auto ptr = dynamic_cast<T*>(this);
 #ifndef NDEBUG
-        assert(ptr != nullptr);
+        assert(dynamic_cast<T*>(this) != nullptr);
 #endif
-        return ptr;
+        return static_cast<T*>(this);
     }
 
     /**
-     * Same as cast<EnumType>(), but by returning an std::shared_ptr()
-     * class.
+     * Dynamically casts the game value in the specified derived GameValue
+     * class, by returning an std::shared_ptr(). Only works on values owned by
+     * a std::shared_ptr.
      * @tparam T
      * @return the dynamically casted GameValue.
      */
@@ -104,17 +164,186 @@ public:
                   std::is_base_of<GameValue, T>::value>::type>
     T const* cst_cast() const
     {
-        auto ptr = dynamic_cast<T const*>(this);
 #ifndef NDEBUG
-        assert(ptr != nullptr);
+        assert(dynamic_cast<T const*>(this) != nullptr);
 #endif
-        return ptr;
+        return static_cast<T const*>(this);
     }
 
 protected:
 private:
 };
 
+/**
+ * Value-semantic holder of a polymorphic GameValue. The built-in value types
+ * are stored in place, so computing deltas and interpolations does no heap
+ * allocation. Bigger custom values fall back to the heap.
+ *
+ * Moving a heap value steals its pointer, moving an in place value copies it
+ * (they are small and nothrow copyable) then empties the moved box.
+ */
+class ValueBox {
+public:
+    /**
+     * Size of the in place storage, fits all the built-in value types.
+     */
+    static constexpr std::size_t inline_size = 48;
+
+    ValueBox() = default;
+
+    ValueBox(GameValue const& value)
+    {
+        value.copy_to(*this);
+    }
+
+    ValueBox(ValueBox const& other)
+    {
+        if (other._value != nullptr) {
+            other._value->copy_to(*this);
+        }
+    }
+
+    ValueBox(ValueBox&& other) noexcept
+    {
+        _take(other);
+    }
+
+    ValueBox& operator=(ValueBox const& other)
+    {
+        if (this != &other) {
+            reset();
+            if (other._value != nullptr) {
+                other._value->copy_to(*this);
+            }
+        }
+        return *this;
+    }
+
+    ValueBox& operator=(ValueBox&& other) noexcept
+    {
+        if (this != &other) {
+            reset();
+            _take(other);
+        }
+        return *this;
+    }
+
+    ~ValueBox()
+    {
+        reset();
+    }
+
+    /**
+     * Constructs a value of type T in the box, replacing the current one.
+     * @return a pointer to the new value.
+     */
+    template <typename T, typename... Args>
+    T* emplace(Args&&... args)
+    {
+        reset();
+        T* value;
+        if constexpr (sizeof(T) <= inline_size
+                      && alignof(T) <= alignof(std::max_align_t)
+                      && std::is_nothrow_copy_constructible_v<T>) {
+            value = new (_storage) T(std::forward<Args>(args)...);
+            _inline = true;
+        }
+        else {
+            value = new T(std::forward<Args>(args)...);
+            _inline = false;
+        }
+        _value = value;
+        return value;
+    }
+
+    /**
+     * Destroys the contained value, if any.
+     */
+    void reset()
+    {
+        if (_value != nullptr) {
+            if (_inline) {
+                _value->~GameValue();
+            }
+            else {
+                delete _value;
+            }
+            _value = nullptr;
+        }
+    }
+
+    GameValue* get() const
+    {
+        return _value;
+    }
+
+    GameValue* operator->() const
+    {
+        return _value;
+    }
+
+    GameValue& operator*() const
+    {
+        return *_value;
+    }
+
+    explicit operator bool() const
+    {
+        return _value != nullptr;
+    }
+
+private:
+    /**
+     * Moves the value of an other box in this empty box, the other box is
+     * left empty.
+     */
+    void _take(ValueBox& other) noexcept
+    {
+        if (other._value == nullptr) {
+            return;
+        }
+        if (other._inline) {
+            other._value->copy_to(*this);
+            other.reset();
+        }
+        else {
+            _value = other._value;
+            _inline = false;
+            other._value = nullptr;
+        }
+    }
+
+    alignas(std::max_align_t) unsigned char _storage[inline_size];
+
+    GameValue* _value = nullptr;
+
+    bool _inline = true;
+};
+
+inline void GameValue::pack(BitWriter& writer,
+                            Quantization const* /*quantization*/) const
+{
+    auto bytes = serialize();
+    writer.write_bytes(bytes.data(), bytes.size());
+}
+
+inline void GameValue::unpack(BitReader& reader,
+                              Quantization const* /*quantization*/)
+{
+    std::string bytes(byte_size(), '\0');
+    reader.read_bytes(bytes.data(), bytes.size());
+    ByteReader byte_reader(bytes.data(), bytes.size());
+    read(byte_reader);
+}
+
+inline ValueBox GameValue::deserialize(std::string const& bytes) const
+{
+    ValueBox value(*this);
+    ByteReader reader(bytes.data(), bytes.size());
+    value->read(reader);
+    return value;
+}
+
 /**
  * Derived from GameValue. Represents a primitive type (for example a int,
  * float)
@@ -137,42 +366,64 @@ public:
         return result.checksum();
     }
 
-    void change(std::shared_ptr<GameValue>& other) override
+    void change(GameValue const& other) override
     {
-        auto other_casted = std::dynamic_pointer_cast<PrimitiveValue>(other);
-        _value = other_casted->_value;
+        _value = other.cst_cast<PrimitiveValue>()->_value;
     }
 
-    virtual std::shared_ptr<GameValue> get_delta(GameValue* delta) override
+    virtual ValueBox get_delta(GameValue const* new_value) const override
     {
-        auto new_value = delta->cast<PrimitiveValue<T>>();
-        auto delta_value =
-            std::make_shared<PrimitiveValue<T>>(new_value->_value - _value);
-        return delta_value->template cast_shared<GameValue>();
+        auto new_value_casted = new_value->cst_cast<PrimitiveValue<T>>();
+        ValueBox delta_value;
+        delta_value.emplace<PrimitiveValue<T>>(new_value_casted->_value
+                                               - _value);
+        return delta_value;
     }
 
-    virtual std::shared_ptr<GameValue> interp(GameValue* delta,
-                                              float interval) override
+    virtual ValueBox interp(GameValue const* delta,
+                            float interval) const override
     {
-        auto delta_value = delta->cast<PrimitiveValue<T>>();
-        auto new_value = std::make_shared<PrimitiveValue<T>>();
-        new_value->_value = _value + (delta_value->_value * interval);
-        return new_value->template cast_shared<GameValue>();
+        auto delta_value = delta->cst_cast<PrimitiveValue<T>>();
+        ValueBox new_value;
+        new_value.emplace<PrimitiveValue<T>>(
+            _value + (delta_value->_value * interval));
+        return new_value;
     }
 
-    std::string serialize() const override
+    void copy_to(ValueBox& box) const override
     {
-        std::stringstream ss;
-        ss.write((char*) &_value, sizeof(_value));
-        return ss.str();
+        box.emplace<PrimitiveValue<T>>(_value);
     }
 
-    std::shared_ptr<GameValue> deserialize(const std::string& bytes) const override
+    std::size_t byte_size() const override
     {
-        std::stringstream ss(bytes);
-        auto value = std::make_shared<PrimitiveValue<T>>();
-        ss.read((char*) &(value->_value), sizeof(T));
-        return value;
+        return sizeof(T);
+    }
+
+    void write(ByteWriter& writer) const override
+    {
+        writer.write(_value);
+    }
+
+    void read(ByteReader& reader) override
+    {
+        _value = reader.read<T>();
+    }
+
+    void pack(BitWriter& writer,
+              Quantization const* quantization) const override
+    {
+        pack_primitive(writer, _value, quantization);
+    }
+
+    void unpack(BitReader& reader, Quantization const* quantization) override
+    {
+        _value = unpack_primitive<T>(reader, quantization);
+    }
+
+    bool is_zero() const override
+    {
+        return _value == T{};
     }
 
     T get_value() const
@@ -208,29 +459,35 @@ public:
         return result.checksum();
     }
 
-    void change(std::shared_ptr<GameValue>& other) override
+    void change(GameValue const& other) override
     {
-        auto other_casted = std::dynamic_pointer_cast<Vec2>(other);
+        auto other_casted = other.cst_cast<Vec2>();
         _x = other_casted->_x;
         _y = other_casted->_y;
     }
 
-    virtual std::shared_ptr<GameValue> get_delta(GameValue* delta) override
+    virtual ValueBox get_delta(GameValue const* new_value) const override
+    {
+        auto new_value_casted = new_value->cst_cast<Vec2<T>>();
+        ValueBox delta_value;
+        delta_value.emplace<Vec2<T>>(new_value_casted->_x - _x,
+                                     new_value_casted->_y - _y);
+        return delta_value;
+    }
+
+    virtual ValueBox interp(GameValue const* delta,
+                            float interval) const override
     {
-        auto new_value = delta->cast<Vec2<T>>();
-        auto delta_value =
-            std::make_shared<Vec2<T>>(new_value->_x - _x, new_value->_y - _y);
-        return delta_value->template cast_shared<GameValue>();
+        auto delta_value = delta->cst_cast<Vec2<T>>();
+        ValueBox new_value;
+        new_value.emplace<Vec2<T>>(_x + (delta_value->_x * interval),
+                                   _y + (delta_value->_y * interval));
+        return new_value;
     }
 
-    virtual std::shared_ptr<GameValue> interp(GameValue* delta,
-                                              float interval) override
+    void copy_to(ValueBox& box) const override
     {
-        auto delta_value = delta->cast<Vec2<T>>();
-        auto new_value = std::make_shared<Vec2<T>>();
-        new_value->_x = _x + (delta_value->_x * interval);
-        new_value->_y = _y + (delta_value->_y * interval);
-        return new_value->template cast_shared<GameValue>();
+        box.emplace<Vec2<T>>(_x, _y);
     }
 
     Vec2 operator-(Vec2 const& other) const
@@ -272,23 +529,39 @@ public:
         return _y;
     }
 
-    std::string serialize() const override
+    std::size_t byte_size() const override
     {
-        std::stringstream ss;
-        ss.write((char*) &_x, sizeof(T));
-        ss.write((char*) &_y, sizeof(T));
-        return ss.str();
+        return 2 * sizeof(T);
     }
 
-    std::shared_ptr<GameValue> deserialize(const std::string& bytes) const override
+    void write(ByteWriter& writer) const override
     {
-        auto value = std::make_shared<Vec2<T>>();
+        writer.write(_x);
+        writer.write(_y);
+    }
 
-        std::stringstream ss(bytes);
-        ss.read((char*) &(value->_x), sizeof(T));
-        ss.read((char*) &(value->_y), sizeof(T));
+    void read(ByteReader& reader) override
+    {
+        _x = reader.read<T>();
+        _y = reader.read<T>();
+    }
 
-        return value;
+    void pack(BitWriter& writer,
+              Quantization const* quantization) const override
+    {
+        pack_primitive(writer, _x, quantization);
+        pack_primitive(writer, _y, quantization);
+    }
+
+    void unpack(BitReader& reader, Quantization const* quantization) override
+    {
+        _x = unpack_primitive<T>(reader, quantization);
+        _y = unpack_primitive<T>(reader, quantization);
+    }
+
+    bool is_zero() const override
+    {
+        return _x == T{} && _y == T{};
     }
 
 protected:
@@ -308,21 +581,28 @@ public:
     {
     }
 
-    virtual std::shared_ptr<GameValue> interp(GameValue* delta,
-                                              float interval) override
+    virtual ValueBox interp(GameValue const* delta,
+                            float interval) const override
     {
         // specifying the THIS keyword tells the compiler that the variable
         // _value is dependant of the initialization of the object.
         // This is required because the compiler does not initialize the
         // parent template before reaching this part of the code
-        return std::make_shared<PrimitiveValueNoInterp>(this->_value);
+        ValueBox new_value;
+        new_value.emplace<PrimitiveValueNoInterp>(this->_value);
+        return new_value;
+    }
+
+    void copy_to(ValueBox& box) const override
+    {
+        box.emplace<PrimitiveValueNoInterp>(this->_value);
     }
 };
 
 /**
  * Predefined common Game value types.
  */
-typedef std::shared_ptr<GameValue> value_t;
+typedef ValueBox value_t;
 
 typedef PrimitiveValue<float> float_value_t;
 typedef PrimitiveValue<int> int_value_t;
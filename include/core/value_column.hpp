@@ -0,0 +1,240 @@
+#pragma once
+#include "core/types.hpp"
+#include <bitset>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <queue>
+#include <vector>
+
+namespace core {
+
+/**
+ * Contiguous storage for one game value field of all the objects of a type
+ * (struct-of-arrays layout). For example all the positions of an object type
+ * are packed together instead of living inside each object.
+ *
+ * Column storage is opt-in: a type stores a field in a column by holding a
+ * ColumnValue member in place of the value. The objects still own their
+ * _values table, which points into the columns, so checksum(), compare() and
+ * the updates work the same for both layouts.
+ *
+ * Values are allocated in fixed size chunks so their address stays stable
+ * when the column grows, which lets GameObject keep pointers to them in its
+ * _values table.
+ *
+ * @tparam T the GameValue type stored in the column.
+ */
+template <typename T,
+          typename = typename std::enable_if<
+              std::is_base_of<GameValue, T>::value>::type>
+class ValueColumn {
+public:
+    /**
+     * Number of values per chunk.
+     */
+    static constexpr std::uint32_t chunk_size = 256;
+
+    /**
+     * Slot index and address of a value allocated in the column.
+     */
+    struct Slot {
+        std::uint32_t index;
+
+        T* value;
+    };
+
+    ValueColumn() = default;
+
+    ValueColumn(ValueColumn const& other) = delete;
+
+    ~ValueColumn()
+    {
+        for (std::uint32_t chunk = 0; chunk < _chunks.size(); chunk++) {
+            for (std::uint32_t slot = 0; slot < chunk_size; slot++) {
+                if (_chunks[chunk]->used[slot]) {
+                    _chunks[chunk]->at(slot)->~T();
+                }
+            }
+        }
+    }
+
+    /**
+     * Constructs a new value in a free slot of the column, reusing the lowest
+     * released slot first to keep the live values packed.
+     * Values are allocated concurrently when objects are cloned by the
+     * worker threads, so the address is returned along with the index while
+     * the chunk table can't be reallocated.
+     * @param args, the value constructor arguments.
+     * @return the index and the address of the slot.
+     */
+    template <typename... Args>
+    Slot allocate(Args&&... args)
+    {
+        std::scoped_lock lock(_mutex);
+        std::uint32_t index;
+        if (!_free_slots.empty()) {
+            index = _free_slots.top();
+            _free_slots.pop();
+        }
+        else {
+            if (_next_slot == _chunks.size() * chunk_size) {
+                _chunks.push_back(std::make_unique<Chunk>());
+            }
+            index = _next_slot++;
+        }
+        auto& chunk = *_chunks[index / chunk_size];
+        auto* value =
+            new (chunk.at(index % chunk_size)) T(std::forward<Args>(args)...);
+        chunk.used[index % chunk_size] = true;
+        _size++;
+        return Slot{index, value};
+    }
+
+    /**
+     * Destroys the value of a slot and makes it available again.
+     * @param index, the slot index returned by allocate().
+     */
+    void release(std::uint32_t index)
+    {
+        std::scoped_lock lock(_mutex);
+        auto& chunk = *_chunks[index / chunk_size];
+#ifndef NDEBUG
+        assert(chunk.used[index % chunk_size]);
+#endif
+        chunk.at(index % chunk_size)->~T();
+        chunk.used[index % chunk_size] = false;
+        _free_slots.push(index);
+        _size--;
+    }
+
+    /**
+     * @return the value stored at the given slot. Locks the column, as the
+     * chunk table may grow concurrently: keep the address returned by
+     * allocate() instead in the hot paths.
+     */
+    T* at(std::uint32_t index) const
+    {
+        std::scoped_lock lock(_mutex);
+        return _chunks[index / chunk_size]->at(index % chunk_size);
+    }
+
+    /**
+     * @return the number of values alive in the column.
+     */
+    std::size_t size() const
+    {
+        std::scoped_lock lock(_mutex);
+        return _size;
+    }
+
+    /**
+     * Calls the function on every value alive in the column, in memory order.
+     * Useful to run a system (physics, ...) over one field of all the objects
+     * at once. The column must not be modified during the iteration.
+     * @param func, a callable taking a T&.
+     */
+    template <typename F>
+    void for_each(F&& func)
+    {
+        for (auto& chunk : _chunks) {
+            for (std::uint32_t slot = 0; slot < chunk_size; slot++) {
+                if (chunk->used[slot]) {
+                    func(*chunk->at(slot));
+                }
+            }
+        }
+    }
+
+private:
+    struct Chunk {
+        alignas(T) unsigned char storage[chunk_size * sizeof(T)];
+
+        std::bitset<chunk_size> used;
+
+        T* at(std::uint32_t slot)
+        {
+            return std::launder(reinterpret_cast<T*>(storage) + slot);
+        }
+    };
+
+    std::vector<std::unique_ptr<Chunk>> _chunks;
+
+    std::priority_queue<std::uint32_t,
+                        std::vector<std::uint32_t>,
+                        std::greater<std::uint32_t>>
+        _free_slots;
+
+    std::uint32_t _next_slot = 0;
+
+    std::size_t _size = 0;
+
+    mutable std::mutex _mutex;
+};
+
+/**
+ * Handle owning a value slot in a ValueColumn. Game objects use it as a member
+ * in place of the game value itself, and bind get() in their _values table.
+ *
+ * Copying the handle allocates a new slot in the same column, so that cloned
+ * objects keep their values in the column as well.
+ *
+ * @tparam T the GameValue type stored in the column.
+ */
+template <typename T>
+class ColumnValue {
+public:
+    template <typename... Args>
+    explicit ColumnValue(ValueColumn<T>& column, Args&&... args)
+        : _column(&column), _slot(column.allocate(std::forward<Args>(args)...))
+    {
+    }
+
+    ColumnValue(ColumnValue const& other)
+        : _column(other._column), _slot(_column->allocate(*other._slot.value))
+    {
+    }
+
+    ColumnValue& operator=(ColumnValue const& other)
+    {
+        *_slot.value = *other._slot.value;
+        return *this;
+    }
+
+    ~ColumnValue()
+    {
+        _column->release(_slot.index);
+    }
+
+    T* get() const
+    {
+        return _slot.value;
+    }
+
+    T& operator*() const
+    {
+        return *_slot.value;
+    }
+
+    T* operator->() const
+    {
+        return _slot.value;
+    }
+
+    /**
+     * @return the slot index of the value in its column.
+     */
+    std::uint32_t index() const
+    {
+        return _slot.index;
+    }
+
+private:
+    ValueColumn<T>* _column;
+
+    typename ValueColumn<T>::Slot _slot;
+};
+
+} // namespace core
@@ -0,0 +1,264 @@
+#pragma once
+#include "core/bit_buffer.hpp"
+#include "core/types.hpp"
+#include <cstdint>
+#include <initializer_list>
+#include <memory_resource>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace core {
+
+/**
+ * Index of a game value in the schema of its object (or action) type.
+ */
+typedef std::uint16_t field_id_t;
+
+/**
+ * Declares the game values of an object (or action) type once. Each field is
+ * addressed by its index in the schema, names are only kept for debugging and
+ * for the serialization wire format.
+ *
+ * Types declare their schema as a static member and bind their values to it
+ * in add_values():
+ *
+ *     static inline const core::ValueSchema value_schema{"position", "speed"};
+ *
+ *     void add_values() override
+ *     {
+ *         _values.bind(value_schema, {&_position, &_speed});
+ *     }
+ *
+ * Floating point fields can be given a quantization, used by the bit-packed
+ * delta snapshot format:
+ *
+ *     static inline const core::ValueSchema value_schema{
+ *         {"position", core::Quantization{0.001f, 24}}, "speed"};
+ */
+class ValueSchema {
+public:
+    /**
+     * Field declaration, a name and an optional quantization.
+     */
+    struct Field {
+        Field(char const* name) : name(name)
+        {
+        }
+
+        Field(std::string name) : name(std::move(name))
+        {
+        }
+
+        Field(std::string name, Quantization quantization)
+            : name(std::move(name)),
+              quantization(quantization),
+              quantized(true)
+        {
+        }
+
+        std::string name;
+        Quantization quantization;
+        bool quantized = false;
+    };
+
+    /**
+     * @throws InvalidQuantizationException if a quantization has a number of
+     * bits outside of [1, 63] or a precision that isn't positive.
+     */
+    ValueSchema(std::initializer_list<Field> fields);
+
+    ValueSchema(ValueSchema const& other) = delete;
+
+    /**
+     * @return the number of fields of the schema.
+     */
+    [[nodiscard]] field_id_t size() const;
+
+    /**
+     * @return the name of the field at the given index.
+     */
+    [[nodiscard]] std::string const& name(field_id_t field) const;
+
+    /**
+     * Looks up a field index from its name. This is a linear search and
+     * should stay out of the tick paths.
+     * @throws UnknownFieldException if the field doesn't exist.
+     * @return the index of the field.
+     */
+    [[nodiscard]] field_id_t index(std::string const& name) const;
+
+    /**
+     * @return the quantization of the field, nullptr if the field is sent
+     * with full precision.
+     */
+    [[nodiscard]] Quantization const* quantization(field_id_t field) const;
+
+private:
+    std::vector<Field> _fields;
+};
+
+/**
+ * Pointers to the game values of an object, indexed by their schema field.
+ */
+class ValueTable {
+public:
+    ValueTable() = default;
+
+    /**
+     * Not copyable, the pointers are only valid for their own object. Derived
+     * objects must call add_values() in their copy constructor.
+     */
+    ValueTable(ValueTable const& other) = delete;
+
+    ValueTable& operator=(ValueTable const& other) = delete;
+
+    /**
+     * Binds the values of the object to the schema. The values must be given
+     * in the schema order.
+     */
+    void bind(ValueSchema const& schema,
+              std::initializer_list<GameValue*> values);
+
+    GameValue* operator[](field_id_t field) const
+    {
+        return _values[field];
+    }
+
+    /**
+     * Gets a value from its field name.
+     * @throws UnknownFieldException if the field doesn't exist.
+     */
+    [[nodiscard]] GameValue* at(std::string const& name) const;
+
+    /**
+     * @return the number of bound values, 0 if unbound.
+     */
+    [[nodiscard]] field_id_t size() const
+    {
+        return static_cast<field_id_t>(_values.size());
+    }
+
+    /**
+     * @return the schema or nullptr if unbound.
+     */
+    [[nodiscard]] ValueSchema const* schema() const
+    {
+        return _schema;
+    }
+
+private:
+    ValueSchema const* _schema = nullptr;
+
+    std::vector<GameValue*> _values;
+};
+
+/**
+ * Set of differences between two similar objects, sorted by field index. The
+ * value is the delta value of the field.
+ *
+ * The values are allocated from a memory resource, a per-tick arena for the
+ * evaluated deltas (see util::Arena). The set is allocator-aware, so the
+ * diffsets stored in a pmr container use the container resource.
+ */
+class DiffSet {
+public:
+    typedef std::pair<field_id_t, value_t> value_type;
+    typedef std::pmr::vector<value_type>::const_iterator const_iterator;
+    typedef std::pmr::polymorphic_allocator<value_type> allocator_type;
+
+    explicit DiffSet(ValueSchema const* schema = nullptr,
+                     allocator_type allocator = {});
+
+    explicit DiffSet(allocator_type allocator);
+
+    /**
+     * Copies use the default resource, unless given one.
+     */
+    DiffSet(DiffSet const& other) = default;
+
+    DiffSet(DiffSet const& other, allocator_type allocator);
+
+    /**
+     * Moves keep the resource of the moved set.
+     */
+    DiffSet(DiffSet&& other) = default;
+
+    /**
+     * Moves the values if the resources are the same, copies them otherwise.
+     */
+    DiffSet(DiffSet&& other, allocator_type allocator);
+
+    DiffSet& operator=(DiffSet const& other) = default;
+
+    DiffSet& operator=(DiffSet&& other) = default;
+
+    /**
+     * Inserts the delta value of a field. Fields are expected to be inserted
+     * in increasing order, which is what GameObject::compare() does.
+     */
+    void insert(field_id_t field, value_t value);
+
+    /**
+     * @throws std::out_of_range if the field isn't in the set.
+     */
+    [[nodiscard]] value_t const& at(field_id_t field) const;
+
+    /**
+     * Looks up a field by name, only meant for debugging and tests.
+     * @throws std::out_of_range if the field isn't in the set.
+     */
+    [[nodiscard]] value_t const& at(std::string const& name) const;
+
+    [[nodiscard]] std::size_t count(field_id_t field) const;
+
+    /**
+     * Reserves space for the given number of fields.
+     */
+    void reserve(std::size_t size)
+    {
+        _values.reserve(size);
+    }
+
+    [[nodiscard]] std::size_t size() const
+    {
+        return _values.size();
+    }
+
+    [[nodiscard]] bool empty() const
+    {
+        return _values.empty();
+    }
+
+    const_iterator begin() const
+    {
+        return _values.begin();
+    }
+
+    const_iterator end() const
+    {
+        return _values.end();
+    }
+
+    /**
+     * @return the schema of the compared objects.
+     */
+    [[nodiscard]] ValueSchema const* schema() const
+    {
+        return _schema;
+    }
+
+    allocator_type get_allocator() const
+    {
+        return _values.get_allocator();
+    }
+
+private:
+    const_iterator _find(field_id_t field) const;
+
+    ValueSchema const* _schema;
+
+    std::pmr::vector<value_type> _values;
+};
+
+} // namespace core
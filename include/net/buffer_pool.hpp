@@ -0,0 +1,195 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <vector>
+
+namespace net {
+
+/**
+ * Size-class pool of memory blocks for the network buffers (packet bodies,
+ * datagrams, ...). Freed blocks are kept in the free list of their size
+ * class and handed back by the next allocation of that class, so a server in
+ * steady state doesn't call malloc for each packet.
+ *
+ * Blocks can be freed from any thread. Sizes above the largest class go to
+ * the global allocator.
+ */
+class BufferPool {
+public:
+    /**
+     * Size of the smallest class, each class doubles the previous one.
+     */
+    static constexpr std::size_t min_block_size = 64;
+
+    static constexpr std::size_t class_count = 15;
+
+    /**
+     * Size of the largest class (1 MiB).
+     */
+    static constexpr std::size_t max_block_size = min_block_size
+                                                  << (class_count - 1);
+
+    /**
+     * Maximum number of free blocks kept per class, the next ones are given
+     * back to the global allocator.
+     */
+    static constexpr std::size_t max_free_blocks = 1024;
+
+    /**
+     * Maximum number of bytes kept free per class (1 MiB), the large classes
+     * keep fewer blocks than max_free_blocks, at least one.
+     */
+    static constexpr std::size_t max_free_bytes = 1024 * 1024;
+
+    /**
+     * @return the maximum number of free blocks kept for the class of a size.
+     */
+    static constexpr std::size_t max_free(std::size_t size)
+    {
+        return free_limit(size_class(size));
+    }
+
+    /**
+     * @return the process wide pool. It is never destroyed, so buffers can
+     * be released during static destruction.
+     */
+    static BufferPool& instance()
+    {
+        static auto* pool = new BufferPool();
+        return *pool;
+    }
+
+    void* allocate(std::size_t size)
+    {
+        auto index = size_class(size);
+        if (index >= class_count) {
+            return ::operator new(size);
+        }
+        auto& pool_class = _classes[index];
+        {
+            std::scoped_lock lock(pool_class.mutex);
+            if (!pool_class.free_blocks.empty()) {
+                auto* block = pool_class.free_blocks.back();
+                pool_class.free_blocks.pop_back();
+                return block;
+            }
+        }
+        return ::operator new(min_block_size << index);
+    }
+
+    void deallocate(void* block, std::size_t size)
+    {
+        auto index = size_class(size);
+        if (index < class_count) {
+            auto& pool_class = _classes[index];
+            std::scoped_lock lock(pool_class.mutex);
+            if (pool_class.free_blocks.size() < free_limit(index)) {
+                pool_class.free_blocks.push_back(block);
+                return;
+            }
+        }
+        ::operator delete(block);
+    }
+
+    /**
+     * @return the number of free blocks kept for the class of a size.
+     */
+    std::size_t free_blocks(std::size_t size)
+    {
+        auto index = size_class(size);
+        if (index >= class_count) {
+            return 0;
+        }
+        std::scoped_lock lock(_classes[index].mutex);
+        return _classes[index].free_blocks.size();
+    }
+
+private:
+    BufferPool()
+    {
+        for (std::size_t index = 0; index < class_count; index++) {
+            _classes[index].free_blocks.reserve(free_limit(index));
+        }
+    }
+
+    /**
+     * @return the index of the smallest class fitting the size, class_count
+     * if there is none.
+     */
+    static constexpr std::size_t size_class(std::size_t size)
+    {
+        std::size_t index = 0;
+        auto block_size = min_block_size;
+        while (block_size < size && index < class_count) {
+            block_size <<= 1;
+            index++;
+        }
+        return index;
+    }
+
+    /**
+     * @return the maximum number of free blocks kept for a class.
+     */
+    static constexpr std::size_t free_limit(std::size_t index)
+    {
+        return std::clamp<std::size_t>(
+            max_free_bytes / (min_block_size << index), 1, max_free_blocks);
+    }
+
+    struct SizeClass {
+        std::mutex mutex;
+
+        std::vector<void*> free_blocks;
+    };
+
+    std::array<SizeClass, class_count> _classes;
+};
+
+/**
+ * Standard allocator drawing from the BufferPool.
+ */
+template <typename T>
+struct PoolAllocator {
+    typedef T value_type;
+
+    PoolAllocator() = default;
+
+    template <typename U>
+    PoolAllocator(PoolAllocator<U> const& /*other*/)
+    {
+    }
+
+    T* allocate(std::size_t count)
+    {
+        return static_cast<T*>(
+            BufferPool::instance().allocate(count * sizeof(T)));
+    }
+
+    void deallocate(T* pointer, std::size_t count)
+    {
+        BufferPool::instance().deallocate(pointer, count * sizeof(T));
+    }
+
+    template <typename U>
+    bool operator==(PoolAllocator<U> const& /*other*/) const
+    {
+        return true;
+    }
+
+    template <typename U>
+    bool operator!=(PoolAllocator<U> const& /*other*/) const
+    {
+        return false;
+    }
+};
+
+/**
+ * Byte buffer allocated from the BufferPool.
+ */
+typedef std::vector<std::uint8_t, PoolAllocator<std::uint8_t>> buffer_t;
+
+} // namespace net
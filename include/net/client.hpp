@@ -1,5 +1,7 @@
 #pragma once
 #include "net/session.hpp"
+#include "net/udp_session.hpp"
+#include <map>
 
 namespace net {
 template <typename EnumType>
@@ -14,18 +16,38 @@ public:
         disconnect();
     }
 
-    bool connect(const std::string& host, std::uint16_t port)
+    /**
+     * Connects to the server.
+     * @param host, the server address.
+     * @param port, the server port.
+     * @param udp, connects with a UDPSession instead of a TCPSession, the
+     * server must accept UDP sessions.
+     * @return false if the connection failed.
+     */
+    bool connect(const std::string& host,
+                 std::uint16_t port,
+                 bool udp = false)
     {
         try {
             boost::asio::ip::tcp::resolver resolver(_context);
             boost::asio::ip::tcp::resolver::results_type endpoints =
                 resolver.resolve(host, std::to_string(port));
 
-            _session = std::make_unique<net::TCPSession<EnumType>>(
-                std::move(boost::asio::ip::tcp::socket(_context)),
-                _context,
-                _input_queue,
-                OwnerType::CLIENT);
+            if (udp) {
+                auto session = std::make_unique<net::UDPSession<EnumType>>(
+                    _context, _input_queue);
+                for (auto const& pair : _udp_channels) {
+                    session->set_channel(pair.first, pair.second);
+                }
+                _session = std::move(session);
+            }
+            else {
+                _session = std::make_unique<net::TCPSession<EnumType>>(
+                    std::move(boost::asio::ip::tcp::socket(_context)),
+                    _context,
+                    _input_queue,
+                    OwnerType::CLIENT);
+            }
 
             _session->connect_to_server(endpoints);
 
@@ -67,7 +89,16 @@ public:
         }
     }
 
-    util::ThreadSafeDeque<net::OwnedPacket<EnumType>>& input_queue()
+    /**
+     * Sets the channel used for a packet type when connected with UDP, must
+     * be called before connect().
+     */
+    void set_udp_channel(EnumType type, Channel channel)
+    {
+        _udp_channels[type] = channel;
+    }
+
+    util::MPSCRingQueue<net::OwnedPacket<EnumType>>& input_queue()
     {
         return _input_queue;
     }
@@ -75,9 +106,11 @@ public:
 protected:
     boost::asio::io_context _context;
     std::thread _context_thread;
-    std::unique_ptr<net::TCPSession<EnumType>> _session = nullptr;
+    std::unique_ptr<net::Session<EnumType>> _session = nullptr;
 
 private:
-    util::ThreadSafeDeque<net::OwnedPacket<EnumType>> _input_queue;
+    util::MPSCRingQueue<net::OwnedPacket<EnumType>> _input_queue{4096};
+
+    std::map<EnumType, Channel> _udp_channels;
 };
 } // namespace net
\ No newline at end of file
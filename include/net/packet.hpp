@@ -1,4 +1,5 @@
 #pragma once
+#include "net/buffer_pool.hpp"
 #include <cstdint>
 #include <memory>
 #include <vector>
@@ -9,7 +10,7 @@ namespace net {
  * Forward declare the class.
  */
 template <typename EnumType>
-class TCPSession;
+class Session;
 
 template <typename EnumType>
 struct PacketHeader {
@@ -23,8 +24,8 @@ struct Packet {
     // Packet head
     PacketHeader<EnumType> header{};
 
-    // Packet content
-    std::vector<uint8_t> body;
+    // Packet content, allocated from the BufferPool
+    buffer_t body;
 
     size_t size()
     {
@@ -32,9 +33,39 @@ struct Packet {
     }
 };
 
+/**
+ * Packet with an immutable, reference counted body. A packet sent to several
+ * sessions (broadcasts) shares its body instead of copying it per session.
+ */
+template <typename EnumType>
+struct SharedPacket {
+    SharedPacket() = default;
+
+    /**
+     * Takes the body of a packet. Pass an rvalue to avoid copying it.
+     */
+    SharedPacket(Packet<EnumType> packet)
+        : header(packet.header),
+          body(std::allocate_shared<const buffer_t>(
+              PoolAllocator<buffer_t>(), std::move(packet.body)))
+    {
+    }
+
+    // Packet head
+    PacketHeader<EnumType> header{};
+
+    // Packet content, shared between the sessions sending it
+    std::shared_ptr<const buffer_t> body;
+
+    size_t size() const
+    {
+        return body ? body->size() : 0;
+    }
+};
+
 template <typename EnumType>
 struct OwnedPacket {
-    std::shared_ptr<net::TCPSession<EnumType>> remote = nullptr;
+    std::shared_ptr<net::Session<EnumType>> remote = nullptr;
     Packet<EnumType> packet;
 };
 
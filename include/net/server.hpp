@@ -1,7 +1,17 @@
 #pragma once
 #include "net/session.hpp"
+#include "net/udp_session.hpp"
+#include "util/slot_map.hpp"
+#include "util/span.hpp"
+#include <algorithm>
 #include <boost/asio.hpp>
+#include <chrono>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
 namespace net {
 
@@ -10,16 +20,32 @@ namespace net {
  * connections to clients and manages them.
  *
  * To be used, server interface must be inherted with the on_client_connect(),
- * on_client_disconnect() and on_message() implemented.
+ * on_client_disconnect() and on_message() implemented. on_messages() can also
+ * be overridden to handle the packets in batches, see update_batch().
  */
 template <typename EnumType>
 class ServerInterface {
 public:
-    ServerInterface(std::uint16_t port)
-        : _acceptor(
-            _context,
-            boost::asio::ip::tcp::endpoint(boost::asio::ip::tcp::v4(), port))
+    /**
+     * @param port, the TCP port to listen to.
+     * @param io_threads, number of threads handling the network operations.
+     * Each thread runs its own io_context and sessions are spread over them.
+     * @param udp, also accepts UDP sessions on the same port number. They
+     * all run on the first io thread, sharing the server socket.
+     */
+    ServerInterface(std::uint16_t port,
+                    std::size_t io_threads = 1,
+                    bool udp = false)
+        : _contexts(_make_contexts(io_threads)),
+          _acceptor(
+              *_contexts.front(),
+              boost::asio::ip::tcp::endpoint(boost::asio::ip::tcp::v4(), port))
     {
+        if (udp) {
+            _udp_socket = std::make_unique<udp_socket_t>(
+                *_contexts.front(),
+                udp_endpoint_t(boost::asio::ip::udp::v4(), port));
+        }
     }
 
     virtual ~ServerInterface()
@@ -28,36 +54,51 @@ public:
     }
 
     /**
-     * Starts the server by waiting for a new connection and starting a new
-     * thread to handle async tasks.
+     * Starts the server by waiting for a new connection and starting one
+     * thread per io_context to handle async tasks.
      */
     bool start()
     {
         try {
             wait_for_new_connection();
+            if (_udp_socket) {
+                wait_for_datagram();
+            }
 
-            _context_thread = std::thread([this]() { _context.run(); });
+            for (auto& context : _contexts) {
+                _work_guards.push_back(
+                    boost::asio::make_work_guard(*context));
+                _context_threads.emplace_back(
+                    [&context]() { context->run(); });
+            }
         }
         catch (std::exception const& exc) {
             std::cerr << "[Server] Exception: " << exc.what() << "\n";
             return false;
         }
 
-        std::cout << "[Server] Started!\n";
+        std::cout << "[Server] Started with " << _contexts.size()
+                  << " io thread(s)!\n";
         return true;
     }
 
     /**
-     * Stops the server by stopping the context (all the remaining aysnc tasks
-     * are skipped) and joining the async task handler thread.
+     * Stops the server by stopping the contexts (all the remaining aysnc tasks
+     * are skipped) and joining the async task handler threads.
      */
     void stop()
     {
-        _context.stop();
+        _work_guards.clear();
+        for (auto& context : _contexts) {
+            context->stop();
+        }
 
-        if (_context_thread.joinable()) {
-            _context_thread.join();
+        for (auto& thread : _context_threads) {
+            if (thread.joinable()) {
+                thread.join();
+            }
         }
+        _context_threads.clear();
         std::cout << "[Server] Stopped!\n";
     }
 
@@ -68,21 +109,24 @@ public:
      */
     void wait_for_new_connection()
     {
-        _acceptor.async_accept([this](std::error_code ec,
-                                      boost::asio::ip::tcp::socket socket) {
+        // sessions are spread round-robin, all the operations of a session
+        // then run on the thread of its context, in order
+        auto& context = *_contexts[_next_context++ % _contexts.size()];
+        _acceptor.async_accept(context,
+                               [this, &context](std::error_code ec,
+                                                tcp_socket_t socket) {
             if (!ec) {
                 auto session =
                     std::make_shared<TCPSession<EnumType>>(std::move(socket),
-                                                           _context,
+                                                           context,
                                                            _input_queue,
                                                            OwnerType::SERVER);
 
                 if (on_client_connect(session)) {
-                    _sessions.push_back(std::move(session));
-                    _sessions.back()->connect_to_client(_client_id_counter++);
+                    session->connect_to_client(_sessions.insert(session));
 
                     std::cout << "[Server] Connection approved with client: "
-                              << _sessions.back()->id() << "\n";
+                              << session->id() << "\n";
                 }
                 else {
                     std::cout << "[Server] Connection denied.\n";
@@ -96,57 +140,96 @@ public:
         });
     }
 
+    /**
+     * Receives the datagrams of the UDP socket and passes them to the session
+     * of their endpoint. A HELLO datagram from an unknown endpoint creates a
+     * new session, which goes through on_client_connect().
+     */
+    void wait_for_datagram()
+    {
+        _udp_socket->async_receive_from(
+            boost::asio::buffer(_datagram_buffer),
+            _datagram_sender,
+            [this](boost::system::error_code ec, std::size_t length) {
+                if (ec == boost::asio::error::operation_aborted) {
+                    return;
+                }
+                if (!ec) {
+                    _dispatch_datagram(length);
+                }
+                else {
+                    std::cerr << "[Server] Datagram error: " << ec.message()
+                              << std::endl;
+                }
+                wait_for_datagram();
+            });
+    }
+
+    /**
+     * Sets the channel used by the UDP sessions for a packet type, packets
+     * use the reliable channel by default.
+     */
+    void set_udp_channel(EnumType type, Channel channel)
+    {
+        _udp_channels[type] = channel;
+    }
+
     /**
      * Sends a message to the client, removes it from the queue if it is
      * disconnected.
      */
-    void message_client(std::shared_ptr<net::TCPSession<EnumType>> client,
-                        net::Packet<EnumType> const& packet)
+    void message_client(std::shared_ptr<net::Session<EnumType>> client,
+                        net::SharedPacket<EnumType> const& packet)
     {
         if (client && client->is_connected()) {
             client->send_packet(packet);
         }
         else {
             on_client_disconnect(client);
-            client.reset();
-            _sessions.erase(
-                std::remove(_sessions.begin(), _sessions.end(), client),
-                _sessions.end());
+            if (client) {
+                _sessions.erase(client->id());
+            }
         }
     }
 
     /**
      * Sends a message to all the clients excepts one if specified.
-     * (used for broadcasting)
+     * (used for broadcasting). The packet body is shared by all the sessions.
      */
     void message_all_clients(
-        net::Packet<EnumType> const& msg,
-        std::shared_ptr<net::TCPSession<EnumType>> exclude = nullptr)
+        net::SharedPacket<EnumType> const& msg,
+        std::shared_ptr<net::Session<EnumType>> exclude = nullptr)
     {
-        bool invalid_session_exits = false;
-        // do the same as in message_client but erases the client only AFTER
-        // the iterations, as we don't want to modify AND iterate the queue
-        // at the same time.
+        // do the same as in message_client but erases the clients only
+        // AFTER the iterations, as we don't want to modify AND iterate the
+        // session map at the same time.
+        std::vector<util::slot_key_t> disconnected;
         for (auto& client : _sessions) {
-            if (client && client->is_connected()) {
+            if (client->is_connected()) {
                 if (client != exclude) {
                     client->send_packet(msg);
                 }
             }
             else {
                 on_client_disconnect(client);
-                client.reset();
-                invalid_session_exits = true;
+                disconnected.push_back(client->id());
             }
         }
 
-        if (invalid_session_exits) {
-            _sessions.erase(
-                std::remove(_sessions.begin(), _sessions.end(), nullptr),
-                _sessions.end());
+        for (auto id : disconnected) {
+            _sessions.erase(id);
         }
     }
 
+    /**
+     * @return the session of an id, nullptr if it has been removed.
+     */
+    std::shared_ptr<net::Session<EnumType>> find_session(util::slot_key_t id)
+    {
+        auto* session = _sessions.get(id);
+        return session ? *session : nullptr;
+    }
+
     /**
      * Reads all the received packets and launches the on_message on each of
      * them. This function is called by the game loop.
@@ -160,13 +243,78 @@ public:
             _input_queue.wait();
         }
 
-        size_t message_count = 0;
+        _input_queue.drain(
+            [this](net::OwnedPacket<EnumType>&& msg) {
+                on_message(msg.remote, std::move(msg.packet));
+            },
+            max_messages);
+    }
 
-        while (message_count < max_messages && !_input_queue.empty()) {
-            auto msg = _input_queue.pop_front();
-            on_message(msg.remote, msg.packet);
-            message_count++;
+    /**
+     * Maximum number of packets held by the batch, packets left by
+     * update_until() included.
+     */
+    static constexpr std::size_t max_batch_size = 4096;
+
+    /**
+     * Batched version of update(). Drains the received packets at once, then
+     * groups them by session and by runs of the same packet type, and passes
+     * each group to on_messages(). The packets of a session keep their
+     * order, the sessions are handled one after the other in the order of
+     * their first packet.
+     *
+     * @param max_messages, the maximum number of packets to drain.
+     * @param wait, blocks until a packet is received.
+     * @return the number of dispatched packets.
+     */
+    std::size_t update_batch(std::size_t max_messages = -1, bool wait = false)
+    {
+        return update_until(std::chrono::steady_clock::time_point::max(),
+                            max_messages,
+                            wait);
+    }
+
+    /**
+     * Same as update_batch() but stops dispatching at the deadline, so that a
+     * burst of packets doesn't stretch the tick. The deadline is checked
+     * between groups and at least one group is dispatched per call. The
+     * packets left are dispatched first by the next call, which drains new
+     * packets only while the batch holds less than max_batch_size packets.
+     *
+     * @param deadline, the time to stop dispatching at.
+     * @param max_messages, the maximum number of packets to drain.
+     * @param wait, blocks until a packet is received.
+     * @return the number of dispatched packets.
+     */
+    std::size_t update_until(std::chrono::steady_clock::time_point deadline,
+                             std::size_t max_messages = -1,
+                             bool wait = false)
+    {
+        if (wait && _batch_position == _batch.size()) {
+            _input_queue.wait();
+        }
+
+        _fill_batch(max_messages);
+
+        std::size_t dispatched = 0;
+        while (_batch_position < _batch.size()) {
+            auto first = _batch.begin() + _batch_position;
+            auto last = std::find_if(first, _batch.end(), [&](auto const& msg) {
+                return msg.remote != first->remote
+                       || msg.packet.header.id != first->packet.header.id;
+            });
+            std::size_t count = last - first;
+
+            on_messages(first->remote,
+                        util::Span<net::OwnedPacket<EnumType>>(&*first, count));
+            _batch_position += count;
+            dispatched += count;
+
+            if (std::chrono::steady_clock::now() >= deadline) {
+                break;
+            }
         }
+        return dispatched;
     }
 
 protected:
@@ -175,31 +323,144 @@ protected:
      * @param client, pointer to the client's session.
      */
     virtual bool
-    on_client_connect(std::shared_ptr<net::TCPSession<EnumType>> client) = 0;
+    on_client_connect(std::shared_ptr<net::Session<EnumType>> client) = 0;
 
     /**
      * Called upon a client disconnection. Must be overridden.
      * @param client, pointer to the client's session.
      */
     virtual void
-    on_client_disconnect(std::shared_ptr<net::TCPSession<EnumType>> client) = 0;
+    on_client_disconnect(std::shared_ptr<net::Session<EnumType>> client) = 0;
 
     /**
      * Called when receiving a packet from a client.
      */
-    virtual void on_message(std::shared_ptr<net::TCPSession<EnumType>> client,
+    virtual void on_message(std::shared_ptr<net::Session<EnumType>> client,
                             net::Packet<EnumType> packet) = 0;
 
+    /**
+     * Called by update_batch() with a group of packets of the same type from
+     * the same client, in the order they were received. Calls on_message()
+     * on each of them by default.
+     * @param client, pointer to the client's session.
+     * @param messages, the packets, which can be moved from.
+     */
+    virtual void
+    on_messages(std::shared_ptr<net::Session<EnumType>> client,
+                util::Span<net::OwnedPacket<EnumType>> messages)
+    {
+        for (auto& msg : messages) {
+            on_message(client, std::move(msg.packet));
+        }
+    }
+
 private:
     /**
-     * Boost asio core class for async task handling.
+     * Removes the dispatched packets from the batch, then appends the
+     * received ones and groups the batch by session, the sessions ordered by
+     * their first packet. The packets left by update_until() are the first
+     * ones, so their sessions are dispatched first.
      */
-    boost::asio::io_context _context;
+    void _fill_batch(std::size_t max_messages)
+    {
+        _batch.erase(_batch.begin(), _batch.begin() + _batch_position);
+        _batch_position = 0;
+
+        // the packets left stay in the input queue once the batch is full
+        if (_batch.size() >= max_batch_size) {
+            return;
+        }
+        auto drained = _input_queue.drain(
+            [this](net::OwnedPacket<EnumType>&& msg) {
+                _batch.push_back(std::move(msg));
+            },
+            std::min(max_messages, max_batch_size - _batch.size()));
+
+        if (drained > 0) {
+            _session_ranks.clear();
+            for (auto const& msg : _batch) {
+                _session_ranks.emplace(msg.remote.get(), _session_ranks.size());
+            }
+            std::stable_sort(_batch.begin(),
+                             _batch.end(),
+                             [this](auto const& lhs, auto const& rhs) {
+                                 return _session_ranks[lhs.remote.get()]
+                                        < _session_ranks[rhs.remote.get()];
+                             });
+        }
+    }
+
+
+    void _dispatch_datagram(std::size_t length)
+    {
+        auto it = _udp_sessions.find(_datagram_sender);
+        if (it != _udp_sessions.end() && !it->second->is_connected()) {
+            _udp_sessions.erase(it);
+            it = _udp_sessions.end();
+        }
+
+        if (it == _udp_sessions.end()) {
+            DatagramHeader header;
+            if (length < sizeof(header)) {
+                return;
+            }
+            std::memcpy(&header, _datagram_buffer.data(), sizeof(header));
+            if (!header.valid() || header.kind != DatagramHeader::HELLO) {
+                return;
+            }
+
+            auto session =
+                std::make_shared<UDPSession<EnumType>>(*_udp_socket,
+                                                       _datagram_sender,
+                                                       *_contexts.front(),
+                                                       _input_queue);
+            for (auto const& pair : _udp_channels) {
+                session->set_channel(pair.first, pair.second);
+            }
+            if (!on_client_connect(session)) {
+                std::cout << "[Server] UDP connection denied.\n";
+                return;
+            }
+            session->connect_to_client(_sessions.insert(session));
+            it = _udp_sessions.emplace(_datagram_sender, session).first;
+
+            std::cout << "[Server] UDP connection approved with client: "
+                      << session->id() << "\n";
+        }
+        it->second->receive_datagram(_datagram_buffer.data(), length);
+    }
+
+    static std::vector<std::unique_ptr<context_t>>
+    _make_contexts(std::size_t count)
+    {
+        std::vector<std::unique_ptr<context_t>> contexts;
+        for (std::size_t i = 0; i < std::max<std::size_t>(count, 1); i++) {
+            // each context is run by a single thread
+            contexts.push_back(std::make_unique<context_t>(1));
+        }
+        return contexts;
+    }
 
     /**
-     * Working thread that will asynchronously do the tasks.
+     * Boost asio core classes for async task handling, one per io thread.
      */
-    std::thread _context_thread;
+    std::vector<std::unique_ptr<context_t>> _contexts;
+
+    /**
+     * Keep the contexts running while they have no session.
+     */
+    std::vector<boost::asio::executor_work_guard<context_t::executor_type>>
+        _work_guards;
+
+    /**
+     * Working threads that will asynchronously do the tasks.
+     */
+    std::vector<std::thread> _context_threads;
+
+    /**
+     * Context of the next accepted session.
+     */
+    std::size_t _next_context = 0;
 
     /**
      * Acceptor to accept and establish new TCP sessions.
@@ -207,18 +468,45 @@ private:
     boost::asio::ip::tcp::acceptor _acceptor;
 
     /**
-     * Thread safe queue of all the received packets to handle.
+     * Lock-free queue of all the received packets to handle, filled by the
+     * sessions and drained by update().
      */
-    util::ThreadSafeDeque<net::OwnedPacket<EnumType>> _input_queue;
+    util::MPSCRingQueue<net::OwnedPacket<EnumType>> _input_queue{4096};
 
     /**
-     * Queue of user sessions.
+     * Packets drained by update_batch(), grouped by session. The ones before
+     * _batch_position have been dispatched.
      */
-    std::deque<std::shared_ptr<net::TCPSession<EnumType>>> _sessions;
+    std::vector<net::OwnedPacket<EnumType>> _batch;
+
+    std::size_t _batch_position = 0;
 
     /**
-     * Client counter.
+     * Order of the sessions in the batch, by first packet, reused by
+     * _fill_batch().
      */
-    std::uint32_t _client_id_counter = 0;
+    std::unordered_map<net::Session<EnumType>*, std::size_t> _session_ranks;
+
+    /**
+     * User sessions, by id.
+     */
+    util::SlotMap<std::shared_ptr<net::Session<EnumType>>> _sessions;
+
+    /**
+     * Socket shared by the UDP sessions, nullptr if UDP is disabled.
+     */
+    std::unique_ptr<udp_socket_t> _udp_socket;
+
+    /**
+     * UDP sessions by remote endpoint.
+     */
+    std::map<udp_endpoint_t, std::shared_ptr<UDPSession<EnumType>>>
+        _udp_sessions;
+
+    std::map<EnumType, Channel> _udp_channels;
+
+    std::array<std::uint8_t, 65536> _datagram_buffer;
+
+    udp_endpoint_t _datagram_sender;
 };
 } // namespace net
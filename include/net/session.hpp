@@ -1,7 +1,10 @@
 #pragma once
 #include "net/packet.hpp"
-#include "util/tsdeque.hpp"
+#include "util/ring_queue.hpp"
+#include "util/slot_map.hpp"
+#include <atomic>
 #include <boost/asio.hpp>
+#include <cstring>
 #include <iostream>
 #include <variant>
 
@@ -29,7 +32,7 @@ template <typename EnumType>
 class Session : public std::enable_shared_from_this<net::Session<EnumType>> {
 public:
     Session(context_t& context,
-            util::ThreadSafeDeque<OwnedPacket<EnumType>>& in_queue,
+            util::MPSCRingQueue<OwnedPacket<EnumType>>& in_queue,
             OwnerType owner_type)
         : _context(context), _input_queue(in_queue), _owner(owner_type)
     {
@@ -37,15 +40,19 @@ public:
 
     /**
      * Adds a packet to the output queue and starts the asynchronous operation
-     * of sending the messages if needed.
+     * of sending the messages if needed. The session is disconnected if its
+     * output queue is full, as the client doesn't keep up.
+     *
+     * A Packet is implicitly converted, moving or copying its body once. The
+     * same SharedPacket can be sent to many sessions without copies.
      */
-    virtual void send_packet(const net::Packet<EnumType>& packet) = 0;
+    virtual void send_packet(net::SharedPacket<EnumType> packet) = 0;
 
     /**
      * Checks if the socket is open and starts read the headers.
-     * @param id, the id of this session.
+     * @param id, the id of this session, its key in the server session map.
      */
-    virtual void connect_to_client(std::uint32_t id) = 0;
+    virtual void connect_to_client(util::slot_key_t id) = 0;
 
     /**
      * Connects to tge server asynchronously and starts to read the packets.
@@ -73,31 +80,47 @@ public:
      */
     virtual bool is_udp() = 0;
 
-    std::uint32_t id()
+    util::slot_key_t id()
     {
         return _id;
     }
 
+    /**
+     * @return the key of the data attached to the session by the server
+     * application (its session info, ...), null_slot_key if there is none.
+     */
+    util::slot_key_t user_key() const
+    {
+        return _user_key;
+    }
+
+    void set_user_key(util::slot_key_t key)
+    {
+        _user_key = key;
+    }
+
 protected:
-    std::uint32_t _id = 0;
+    util::slot_key_t _id = util::null_slot_key;
+
+    util::slot_key_t _user_key = util::null_slot_key;
 
     OwnerType _owner = SERVER;
 
     /**
      * Reference to the input queue. (Received messages are put to the queue).
      */
-    util::ThreadSafeDeque<net::OwnedPacket<EnumType>>& _input_queue;
+    util::MPSCRingQueue<net::OwnedPacket<EnumType>>& _input_queue;
 
     /**
      * TCPSession's output queue. (Message to send are put to the queue).
      */
-    util::ThreadSafeDeque<net::Packet<EnumType>> _output_queue;
+    util::MPSCRingQueue<net::SharedPacket<EnumType>> _output_queue{1024};
 
     /**
-     * Temporary packet used in the read_header(), read_body() and
-     * add_packet_to_input_queue() methods.
+     * True while the context is writing the output queue to the socket. The
+     * thread setting it starts the write loop.
      */
-    net::Packet<EnumType> _temp_packet;
+    std::atomic<bool> _writing{false};
 
     /**
      * Reference to the context.
@@ -115,37 +138,34 @@ class TCPSession : public Session<EnumType> {
 public:
     TCPSession(tcp_socket_t socket,
                context_t& context,
-               util::ThreadSafeDeque<OwnedPacket<EnumType>>& in_queue,
+               util::MPSCRingQueue<OwnedPacket<EnumType>>& in_queue,
                OwnerType owner_type)
         : Session<EnumType>(context, in_queue, owner_type),
           _socket(std::move(socket))
     {
     }
 
-    void send_packet(const net::Packet<EnumType>& packet) override
+    void send_packet(net::SharedPacket<EnumType> packet) override
     {
-        this->_context.post([this, packet] {
-            // If the queue is not empty, we assume that
-            // we are already asynchronously writing to the network, and adding
-            // a new packet to the queue will be processed after the current
-            // wrote packet.
-
-            // If the queue is empty, then this means that the async writing
-            // process already finished and need to be relaunched.
-            bool writing_message = !this->_output_queue.empty();
-            this->_output_queue.push_back(packet);
-            if (!writing_message) {
-                write_header();
-            }
-        });
+        if (!this->_output_queue.try_push(std::move(packet))) {
+            std::cerr << "[TCPSession " << this->_id
+                      << "] Output queue full, disconnecting.\n";
+            disconnect();
+            return;
+        }
+        // starts the write loop unless it is already running, in which case
+        // it will reach the packet
+        if (!this->_writing.exchange(true)) {
+            this->_context.post([this] { write_next(); });
+        }
     }
 
-    void connect_to_client(std::uint32_t id) override
+    void connect_to_client(util::slot_key_t id) override
     {
         if (this->_owner == SERVER) {
+            this->_id = id;
             if (is_connected()) {
-                this->_id = id;
-                read_header();
+                read_next();
             }
         }
     }
@@ -160,7 +180,7 @@ public:
                 [this](std::error_code ec,
                        boost::asio::ip::tcp::endpoint endpoint) {
                     if (!ec) {
-                        read_header();
+                        read_next();
                     }
                 });
         }
@@ -201,120 +221,131 @@ private:
     }
 
     /**
-     * Writes the output queue's front packet's header. If necessary, calls the
-     * write_body() method. If not necessary then pops it from the output queue,
-     * and, if the output queue is not empty, then proceeds by calling again
-     * write_header().
+     * Pops the queued packets, up to write_budget bytes, and writes their
+     * headers and bodies with a single gather write. Stops the write loop if
+     * the queue is empty.
      */
-    void write_header()
+    void write_next()
     {
-        boost::asio::async_write(
-            _socket,
-            boost::asio::buffer(&this->_output_queue.front().header,
-                                sizeof(net::PacketHeader<EnumType>)),
-            [this](std::error_code ec, size_t wrote) {
-                if (!ec) {
-                    if (this->_output_queue.front().body.size() > 0) {
-                        write_body();
-                    }
-                    else {
-                        this->_output_queue.pop_front();
-                        if (!this->_output_queue.empty()) {
-                            write_header();
-                        }
-                    }
-                }
-                else {
-                    std::cerr << "[TCPSession " << this->_id
-                              << "] Write header failed: " << ec.message()
-                              << "\n";
-                    close_socket();
-                }
-            });
-    }
+        _write_batch.clear();
+        std::size_t batch_size = 0;
+        net::SharedPacket<EnumType> packet;
+        while (batch_size < write_budget
+               && this->_output_queue.try_pop(packet)) {
+            batch_size += sizeof(net::PacketHeader<EnumType>) + packet.size();
+            _write_batch.push_back(std::move(packet));
+        }
+
+        if (_write_batch.empty()) {
+            this->_writing.store(false);
+            // a packet pushed before the flag was cleared would not restart
+            // the loop, checks the queue again
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (!this->_output_queue.empty()
+                && !this->_writing.exchange(true)) {
+                write_next();
+            }
+            return;
+        }
+
+        // the batch is complete, its packets don't move anymore
+        _write_buffers.clear();
+        for (auto const& batch_packet : _write_batch) {
+            _write_buffers.push_back(
+                boost::asio::buffer(&batch_packet.header,
+                                    sizeof(net::PacketHeader<EnumType>)));
+            if (batch_packet.size() > 0) {
+                _write_buffers.push_back(
+                    boost::asio::buffer(batch_packet.body->data(),
+                                        batch_packet.body->size()));
+            }
+        }
 
-    /**
-     * Writes the output queue's front packet's body and pops it from the queue,
-     * then calls the write_header() method if the output queue is still not
-     * empty.
-     */
-    void write_body()
-    {
         boost::asio::async_write(
             _socket,
-            boost::asio::buffer(this->_output_queue.front().body.data(),
-                                this->_output_queue.front().body.size()),
-            [this](std::error_code ec, size_t length) {
+            _write_buffers,
+            [this](std::error_code ec, size_t /*wrote*/) {
                 if (!ec) {
-                    this->_output_queue.pop_front();
-                    if (!this->_output_queue.empty()) {
-                        write_header();
-                    }
+                    write_next();
                 }
                 else {
                     std::cerr << "[TCPSession " << this->_id
-                              << "] Write body failed: " << ec.message()
-                              << "\n";
+                              << "] Write failed: " << ec.message() << "\n";
                     close_socket();
                 }
             });
     }
 
     /**
-     * Reads the header of the next packet and sets the length of the temporary
-     * packet body accordingly.
+     * Reads as many bytes as available in the receive buffer, then frames
+     * the complete packets out of it.
      */
-    void read_header()
+    void read_next()
     {
-        // this shouldn't compile
-        boost::asio::async_read(
-            _socket,
-            boost::asio::buffer(&this->_temp_packet.header,
-                                sizeof(PacketHeader<EnumType>)),
+        if (_read_buffer.size() - _read_end < read_chunk_size) {
+            _read_buffer.resize(_read_end + read_chunk_size);
+        }
+        _socket.async_read_some(
+            boost::asio::buffer(_read_buffer.data() + _read_end,
+                                _read_buffer.size() - _read_end),
             [this](std::error_code ec, size_t length) {
                 if (!ec) {
-                    if (length > 0) {
-                        // Now that we have the size we resize the array of our
-                        // packet and proceed to read the body
-                        this->_temp_packet.body.resize(
-                            this->_temp_packet.header.size);
-                        read_body();
-                    }
-                    else {
-                        // length <= 0 means that the packet is header only
-                        // we proceed
-                        add_packet_to_input_queue();
+                    _read_end += length;
+                    if (frame_packets()) {
+                        read_next();
                     }
                 }
                 else {
                     std::cout << "[TCPSession " << this->_id
-                              << "] Read header failed: " << ec.message()
-                              << "\n";
+                              << "] Read failed: " << ec.message() << "\n";
                     close_socket();
                 }
             });
     }
 
     /**
-     * Reads the body of the next packet. This method is called by read_header()
-     * if necessary.
+     * Adds the complete packets of the receive buffer to the input queue and
+     * moves the remaining partial packet to the front of the buffer.
+     * @return false if a packet is too large, the socket is then closed.
      */
-    void read_body()
+    bool frame_packets()
     {
-        boost::asio::async_read(
-            _socket,
-            boost::asio::buffer(this->_temp_packet.body.data(),
-                                this->_temp_packet.body.size()),
-            [this](std::error_code ec, size_t length) {
-                if (!ec) {
-                    add_packet_to_input_queue();
-                }
-                else {
-                    std::cerr << "[TCPSession " << this->_id
-                              << "] Read body failed: " << ec.message() << "\n";
-                    close_socket();
-                }
-            });
+        std::shared_ptr<TCPSession<EnumType>> remote = nullptr;
+        if (this->_owner == SERVER) {
+            remote = shared_from_this();
+        }
+
+        constexpr auto header_size = sizeof(net::PacketHeader<EnumType>);
+        std::size_t position = 0;
+        while (_read_end - position >= header_size) {
+            net::Packet<EnumType> packet;
+            std::memcpy(
+                &packet.header, _read_buffer.data() + position, header_size);
+
+            if (packet.header.size > max_packet_size) {
+                std::cerr << "[TCPSession " << this->_id
+                          << "] Packet too large: " << packet.header.size
+                          << " bytes\n";
+                close_socket();
+                return false;
+            }
+            auto packet_size = header_size + packet.header.size;
+            if (_read_end - position < packet_size) {
+                break;
+            }
+
+            auto body = _read_buffer.begin() + position + header_size;
+            packet.body.assign(body, body + packet.header.size);
+            this->_input_queue.push({remote, std::move(packet)});
+            position += packet_size;
+        }
+
+        // keeps the partial packet for the next read
+        std::memmove(_read_buffer.data(),
+                     _read_buffer.data() + position,
+                     _read_end - position);
+        _read_end -= position;
+        return true;
     }
 
     /**
@@ -326,23 +357,46 @@ private:
     }
 
     /**
-     * Adds a packet to the input queue and proceeds by calling read_header()
+     * The used socket.
      */
-    void add_packet_to_input_queue()
-    {
-        if (this->_owner == SERVER) {
-            this->_input_queue.push_back(
-                {shared_from_this(), this->_temp_packet});
-        }
-        else {
-            this->_input_queue.push_back({nullptr, this->_temp_packet});
-        }
-        read_header();
-    }
+    tcp_socket_t _socket;
 
     /**
-     * The used socket.
+     * Minimum free space of the receive buffer for a read.
      */
-    tcp_socket_t _socket;
+    static constexpr std::size_t read_chunk_size = 16 * 1024;
+
+    /**
+     * Largest accepted packet body, protects the receive buffer against
+     * malformed headers.
+     */
+    static constexpr std::size_t max_packet_size = 16 * 1024 * 1024;
+
+    /**
+     * Receive buffer, holds the bytes read from the socket until they form
+     * complete packets.
+     */
+    buffer_t _read_buffer;
+
+    /**
+     * Number of bytes received in _read_buffer.
+     */
+    std::size_t _read_end = 0;
+
+    /**
+     * Maximum number of bytes gathered in a single write, a larger packet is
+     * still written whole.
+     */
+    static constexpr std::size_t write_budget = 64 * 1024;
+
+    /**
+     * Packets being written, popped from the output queue.
+     */
+    std::vector<net::SharedPacket<EnumType>> _write_batch;
+
+    /**
+     * Headers and bodies of the _write_batch packets.
+     */
+    std::vector<boost::asio::const_buffer> _write_buffers;
 };
 } // namespace net
@@ -0,0 +1,696 @@
+#pragma once
+#include "net/session.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <boost/asio.hpp>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <memory>
+#include <vector>
+
+namespace net {
+
+typedef boost::asio::ip::udp::socket udp_socket_t;
+typedef boost::asio::ip::udp::endpoint udp_endpoint_t;
+
+/**
+ * Delivery guarantees of the packets sent over UDP.
+ */
+enum class Channel : std::uint8_t {
+    // retransmitted until acknowledged, delivered in order (connection,
+    // actions, ...)
+    RELIABLE_ORDERED = 0,
+    // never retransmitted, packets older than the last delivered one are
+    // dropped (snapshot deltas, ...)
+    UNRELIABLE_SEQUENCED = 1,
+};
+
+/**
+ * Header of every datagram. A packet (header and body) is sent as one message,
+ * split in fragments when it doesn't fit in a single datagram.
+ */
+struct DatagramHeader {
+    enum Kind : std::uint8_t { HELLO = 0, DATA = 1, ACK = 2 };
+
+    // filters out stray datagrams
+    std::uint16_t protocol = 0x4842;
+
+    Kind kind = DATA;
+
+    Channel channel = Channel::RELIABLE_ORDERED;
+
+    // message sequence number in its channel
+    std::uint16_t sequence = 0;
+
+    std::uint16_t fragment_index = 0;
+
+    std::uint16_t fragment_count = 1;
+
+    bool valid() const
+    {
+        return protocol == DatagramHeader().protocol;
+    }
+};
+
+static_assert(sizeof(DatagramHeader) == 10, "DatagramHeader is not packed");
+
+/**
+ * @return true if the sequence a is more recent than b, handling the wrap
+ * around of the 16 bits counters.
+ */
+inline bool sequence_greater(std::uint16_t a, std::uint16_t b)
+{
+    return a != b && static_cast<std::uint16_t>(a - b) < 0x8000;
+}
+
+/**
+ * Implementation of the session for the UDP protocol, with the sequence
+ * numbers, acknowledgements and fragmentation needed by the channels.
+ *
+ * On the server, all the UDP sessions share the server socket and the
+ * ServerInterface passes them the datagrams of their endpoint. On the client,
+ * the session owns its socket.
+ *
+ * Packets use the reliable channel unless their type is mapped to another one
+ * with set_channel(). A lost unreliable packet never delays the next ones.
+ */
+template <typename EnumType>
+class UDPSession : public Session<EnumType> {
+public:
+    /**
+     * Payload bytes per datagram, keeps the datagrams under the usual MTU.
+     */
+    static constexpr std::size_t max_fragment_size = 1200;
+
+    /**
+     * Largest message (packet header and body) that can be sent.
+     */
+    static constexpr std::size_t max_message_size = 1024 * 1024;
+
+    /**
+     * Server side constructor, the session shares the server socket.
+     */
+    UDPSession(udp_socket_t& socket,
+               udp_endpoint_t remote,
+               context_t& context,
+               util::MPSCRingQueue<OwnedPacket<EnumType>>& in_queue)
+        : Session<EnumType>(context, in_queue, SERVER),
+          _socket(&socket),
+          _remote(std::move(remote)),
+          _timer(context)
+    {
+    }
+
+    /**
+     * Client side constructor, the session opens its own socket when
+     * connecting to the server.
+     */
+    UDPSession(context_t& context,
+               util::MPSCRingQueue<OwnedPacket<EnumType>>& in_queue)
+        : Session<EnumType>(context, in_queue, CLIENT),
+          _owned_socket(std::make_unique<udp_socket_t>(context)),
+          _socket(_owned_socket.get()),
+          _timer(context)
+    {
+    }
+
+    /**
+     * Sets the channel of a packet type. Must be done before sending.
+     */
+    void set_channel(EnumType type, Channel channel)
+    {
+        _channels[type] = channel;
+    }
+
+    void send_packet(net::SharedPacket<EnumType> packet) override
+    {
+        if (!this->_output_queue.try_push(std::move(packet))) {
+            std::cerr << "[UDPSession " << this->_id
+                      << "] Output queue full, disconnecting.\n";
+            disconnect();
+            return;
+        }
+        if (!this->_writing.exchange(true)) {
+            this->_context.post([this] { flush(); });
+        }
+    }
+
+    void connect_to_client(util::slot_key_t id) override
+    {
+        if (this->_owner == SERVER) {
+            this->_id = id;
+            _last_receive = clock_t::now();
+            start_timer();
+        }
+    }
+
+    void connect_to_server(
+        boost::asio::ip::tcp::resolver::results_type const& endpoint) override
+    {
+        if (this->_owner == CLIENT && !endpoint.empty()) {
+            auto const& tcp_endpoint = endpoint.begin()->endpoint();
+            _remote = udp_endpoint_t(tcp_endpoint.address(),
+                                     tcp_endpoint.port());
+            _socket->open(_remote.protocol());
+            _last_receive = clock_t::now();
+
+            // makes the server create the session
+            send_hello();
+
+            receive_next();
+            start_timer();
+        }
+    }
+
+    bool is_connected() override
+    {
+        return !_closed && _socket->is_open();
+    }
+
+    void disconnect() override
+    {
+        if (is_connected()) {
+            this->_context.post([this]() { close(); });
+        }
+    }
+
+    bool is_tcp() override
+    {
+        return false;
+    }
+
+    bool is_udp() override
+    {
+        return true;
+    }
+
+    /**
+     * Handles a datagram received from the remote endpoint. Called by the
+     * receive loop, on the session's context.
+     */
+    void receive_datagram(std::uint8_t const* data, std::size_t length)
+    {
+        DatagramHeader header;
+        if (length < sizeof(header)) {
+            return;
+        }
+        std::memcpy(&header, data, sizeof(header));
+        if (!header.valid()
+            || header.fragment_count == 0
+            || header.fragment_index >= header.fragment_count
+            || header.fragment_count * max_fragment_size
+                   > max_message_size + max_fragment_size) {
+            return;
+        }
+        _last_receive = clock_t::now();
+        _handshaken = true;
+
+        data += sizeof(header);
+        length -= sizeof(header);
+        switch (header.kind) {
+        case DatagramHeader::HELLO:
+            break;
+        case DatagramHeader::ACK:
+            receive_ack(header);
+            break;
+        case DatagramHeader::DATA:
+            if (header.channel == Channel::RELIABLE_ORDERED) {
+                receive_reliable(header, data, length);
+            }
+            else {
+                receive_unreliable(header, data, length);
+            }
+            break;
+        }
+    }
+
+private:
+    typedef std::chrono::steady_clock clock_t;
+
+    /**
+     * Map allocating its nodes from the BufferPool.
+     */
+    template <typename Key, typename Value>
+    using pool_map_t =
+        std::map<Key,
+                 Value,
+                 std::less<Key>,
+                 PoolAllocator<std::pair<const Key, Value>>>;
+
+    /**
+     * Fragments of a message being received.
+     */
+    struct Reassembly {
+        std::vector<buffer_t, PoolAllocator<buffer_t>> fragments;
+
+        std::uint16_t received = 0;
+
+        bool add(DatagramHeader const& header,
+                 std::uint8_t const* data,
+                 std::size_t length)
+        {
+            if (fragments.empty()) {
+                fragments.resize(header.fragment_count);
+            }
+            if (header.fragment_count != fragments.size()) {
+                return false;
+            }
+            auto& fragment = fragments[header.fragment_index];
+            if (fragment.empty() && length > 0) {
+                fragment.assign(data, data + length);
+                received++;
+            }
+            return complete();
+        }
+
+        /**
+         * @return true if the fragment of the datagram has been stored.
+         */
+        bool contains(DatagramHeader const& header) const
+        {
+            return header.fragment_count == fragments.size()
+                   && !fragments[header.fragment_index].empty();
+        }
+
+        bool complete() const
+        {
+            return !fragments.empty() && received == fragments.size();
+        }
+    };
+
+    /**
+     * A reliable datagram waiting for its acknowledgement.
+     */
+    struct Unacked {
+        std::shared_ptr<buffer_t> datagram;
+
+        clock_t::time_point sent;
+    };
+
+    /**
+     * Time without acknowledgement before a reliable datagram is sent again.
+     */
+    static constexpr std::chrono::milliseconds resend_delay{100};
+
+    /**
+     * Time without any datagram before the session is closed.
+     */
+    static constexpr std::chrono::seconds timeout{10};
+
+    /**
+     * Maximum number of reliable messages received ahead of the next one to
+     * deliver, and of partial unreliable messages kept. The sender keeps at
+     * most as many reliable messages unacknowledged.
+     */
+    static constexpr std::uint16_t receive_window = 256;
+
+    /**
+     * Maximum number of reliable packets waiting for the send window.
+     */
+    static constexpr std::size_t max_send_backlog = 1024;
+
+    Channel channel_of(EnumType type) const
+    {
+        auto it = _channels.find(type);
+        return it != _channels.end() ? it->second : Channel::RELIABLE_ORDERED;
+    }
+
+    std::shared_ptr<buffer_t> make_datagram(DatagramHeader const& header,
+                                            std::uint8_t const* payload,
+                                            std::size_t length)
+    {
+        auto datagram = std::allocate_shared<buffer_t>(
+            PoolAllocator<buffer_t>(), sizeof(header) + length);
+        std::memcpy(datagram->data(), &header, sizeof(header));
+        if (length > 0) {
+            std::memcpy(datagram->data() + sizeof(header), payload, length);
+        }
+        return datagram;
+    }
+
+    void send_hello()
+    {
+        DatagramHeader hello;
+        hello.kind = DatagramHeader::HELLO;
+        send_datagram(make_datagram(hello, nullptr, 0));
+    }
+
+    void send_datagram(std::shared_ptr<buffer_t> datagram)
+    {
+        _socket->async_send_to(
+            boost::asio::buffer(*datagram),
+            _remote,
+            [datagram](std::error_code /*ec*/, std::size_t /*length*/) {});
+    }
+
+    /**
+     * Sends the queued packets, fragmenting them. Runs on the context.
+     */
+    void flush()
+    {
+        net::SharedPacket<EnumType> packet;
+        while (this->_output_queue.try_pop(packet)) {
+            send_message(packet);
+        }
+        this->_writing.store(false);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!this->_output_queue.empty() && !this->_writing.exchange(true)) {
+            flush();
+        }
+    }
+
+    void send_message(net::SharedPacket<EnumType> const& packet)
+    {
+        // the sequences in flight stay in the receive window, they can't
+        // wrap around either
+        if (channel_of(packet.header.id) == Channel::RELIABLE_ORDERED
+            && (!_send_backlog.empty() || send_window_full())) {
+            if (_send_backlog.size() >= max_send_backlog) {
+                std::cerr << "[UDPSession " << this->_id
+                          << "] Send backlog full, disconnecting.\n";
+                close();
+                return;
+            }
+            _send_backlog.push_back(packet);
+            return;
+        }
+        send_fragments(packet);
+    }
+
+    void send_fragments(net::SharedPacket<EnumType> const& packet)
+    {
+        buffer_t message(sizeof(packet.header) + packet.size());
+        std::memcpy(message.data(), &packet.header, sizeof(packet.header));
+        if (packet.size() > 0) {
+            std::memcpy(message.data() + sizeof(packet.header),
+                        packet.body->data(),
+                        packet.size());
+        }
+        if (message.size() > max_message_size) {
+            std::cerr << "[UDPSession " << this->_id
+                      << "] Packet too large, dropped.\n";
+            return;
+        }
+
+        DatagramHeader header;
+        header.kind = DatagramHeader::DATA;
+        header.channel = channel_of(packet.header.id);
+        auto& next_sequence =
+            _next_sequence[static_cast<std::size_t>(header.channel)];
+        header.sequence = next_sequence++;
+        header.fragment_count = static_cast<std::uint16_t>(
+            (message.size() + max_fragment_size - 1) / max_fragment_size);
+
+        for (std::uint16_t i = 0; i < header.fragment_count; i++) {
+            header.fragment_index = i;
+            auto offset = i * max_fragment_size;
+            auto datagram = make_datagram(
+                header,
+                message.data() + offset,
+                std::min(max_fragment_size, message.size() - offset));
+            if (header.channel == Channel::RELIABLE_ORDERED) {
+                _unacked[{header.sequence, i}] = {datagram, clock_t::now()};
+            }
+            send_datagram(std::move(datagram));
+        }
+    }
+
+    bool send_window_full() const
+    {
+        auto next_sequence = _next_sequence[static_cast<std::size_t>(
+            Channel::RELIABLE_ORDERED)];
+        return static_cast<std::uint16_t>(next_sequence - _send_base)
+               >= receive_window;
+    }
+
+    void receive_ack(DatagramHeader const& header)
+    {
+        _unacked.erase({header.sequence, header.fragment_index});
+
+        // slides the send window past the fully acknowledged messages
+        auto next_sequence = _next_sequence[static_cast<std::size_t>(
+            Channel::RELIABLE_ORDERED)];
+        while (_send_base != next_sequence) {
+            auto it = _unacked.lower_bound({_send_base, 0});
+            if (it != _unacked.end() && it->first.first == _send_base) {
+                break;
+            }
+            _send_base++;
+        }
+
+        while (!_send_backlog.empty() && !send_window_full()) {
+            auto packet = std::move(_send_backlog.front());
+            _send_backlog.pop_front();
+            send_fragments(packet);
+        }
+    }
+
+    void send_ack(DatagramHeader const& header)
+    {
+        DatagramHeader ack = header;
+        ack.kind = DatagramHeader::ACK;
+        send_datagram(make_datagram(ack, nullptr, 0));
+    }
+
+    void receive_reliable(DatagramHeader const& header,
+                          std::uint8_t const* data,
+                          std::size_t length)
+    {
+        // acknowledges the duplicates of delivered messages again, the
+        // previous ack may have been lost
+        if (header.sequence != _next_reliable
+            && !sequence_greater(header.sequence, _next_reliable)) {
+            send_ack(header);
+            return;
+        }
+        // not acknowledged, the sender sends it again once the window moved
+        if (static_cast<std::uint16_t>(header.sequence - _next_reliable)
+            >= receive_window) {
+            return;
+        }
+        auto& reassembly = _reliable_pending[header.sequence];
+        reassembly.add(header, data, length);
+        if (!reassembly.contains(header)) {
+            return;
+        }
+        send_ack(header);
+
+        // delivers the following complete messages, in order
+        auto it = _reliable_pending.find(_next_reliable);
+        while (it != _reliable_pending.end() && it->second.complete()) {
+            deliver(it->second);
+            _reliable_pending.erase(it);
+            it = _reliable_pending.find(++_next_reliable);
+        }
+    }
+
+    void receive_unreliable(DatagramHeader const& header,
+                            std::uint8_t const* data,
+                            std::size_t length)
+    {
+        if (_has_unreliable
+            && !sequence_greater(header.sequence, _last_unreliable)) {
+            return;
+        }
+        auto& reassembly = _unreliable_pending[header.sequence];
+        if (!reassembly.add(header, data, length)) {
+            if (_unreliable_pending.size() > receive_window) {
+                // the keys wrap around, the oldest one isn't the lowest
+                _unreliable_pending.erase(std::min_element(
+                    _unreliable_pending.begin(),
+                    _unreliable_pending.end(),
+                    [](auto const& a, auto const& b) {
+                        return sequence_greater(b.first, a.first);
+                    }));
+            }
+            return;
+        }
+        deliver(reassembly);
+        _last_unreliable = header.sequence;
+        _has_unreliable = true;
+
+        // partial older messages will never be delivered
+        for (auto it = _unreliable_pending.begin();
+             it != _unreliable_pending.end();) {
+            if (!sequence_greater(it->first, _last_unreliable)) {
+                it = _unreliable_pending.erase(it);
+            }
+            else {
+                it++;
+            }
+        }
+    }
+
+    /**
+     * Rebuilds the packet of a complete message and adds it to the input
+     * queue.
+     */
+    void deliver(Reassembly const& reassembly)
+    {
+        // the packet header is always in the first fragment
+        net::Packet<EnumType> packet;
+        auto const& first = reassembly.fragments.front();
+        if (first.size() < sizeof(packet.header)) {
+            return;
+        }
+        std::memcpy(&packet.header, first.data(), sizeof(packet.header));
+
+        std::size_t message_size = 0;
+        for (auto const& fragment : reassembly.fragments) {
+            message_size += fragment.size();
+        }
+        if (message_size - sizeof(packet.header) != packet.header.size) {
+            return;
+        }
+
+        packet.body.reserve(packet.header.size);
+        packet.body.assign(first.begin() + sizeof(packet.header), first.end());
+        for (std::size_t i = 1; i < reassembly.fragments.size(); i++) {
+            auto const& fragment = reassembly.fragments[i];
+            packet.body.insert(
+                packet.body.end(), fragment.begin(), fragment.end());
+        }
+
+        std::shared_ptr<Session<EnumType>> remote = nullptr;
+        if (this->_owner == SERVER) {
+            remote = this->shared_from_this();
+        }
+        this->_input_queue.push({remote, std::move(packet)});
+    }
+
+    /**
+     * Client side receive loop on the owned socket.
+     */
+    void receive_next()
+    {
+        _socket->async_receive_from(
+            boost::asio::buffer(_receive_buffer),
+            _receive_sender,
+            [this](boost::system::error_code ec, std::size_t length) {
+                if (ec) {
+                    if (ec != boost::asio::error::operation_aborted) {
+                        std::cerr << "[UDPSession] Receive failed: "
+                                  << ec.message() << "\n";
+                        close();
+                    }
+                    return;
+                }
+                if (_receive_sender == _remote) {
+                    receive_datagram(_receive_buffer.data(), length);
+                }
+                receive_next();
+            });
+    }
+
+    /**
+     * Resends the unacknowledged reliable datagrams and closes the session
+     * when the remote stays silent for too long.
+     */
+    void start_timer()
+    {
+        _timer.expires_after(resend_delay / 2);
+        _timer.async_wait([this](std::error_code ec) {
+            if (ec || _closed) {
+                return;
+            }
+            auto now = clock_t::now();
+            if (now - _last_receive > timeout) {
+                std::cerr << "[UDPSession " << this->_id << "] Timed out.\n";
+                close();
+                return;
+            }
+            // the hello may have been lost
+            if (this->_owner == CLIENT && !_handshaken) {
+                send_hello();
+            }
+            for (auto& pair : _unacked) {
+                if (now - pair.second.sent > resend_delay) {
+                    pair.second.sent = now;
+                    send_datagram(pair.second.datagram);
+                }
+            }
+            start_timer();
+        });
+    }
+
+    void close()
+    {
+        _closed = true;
+        _timer.cancel();
+        if (_owned_socket) {
+            _owned_socket->close();
+        }
+    }
+
+    /**
+     * Socket owned by the session, client side only.
+     */
+    std::unique_ptr<udp_socket_t> _owned_socket;
+
+    /**
+     * The used socket, shared with the other sessions on the server.
+     */
+    udp_socket_t* _socket;
+
+    udp_endpoint_t _remote;
+
+    boost::asio::steady_timer _timer;
+
+    /**
+     * Set by close(), read by is_connected() from any thread.
+     */
+    std::atomic<bool> _closed{false};
+
+    /**
+     * True once a datagram has been received from the remote.
+     */
+    bool _handshaken = false;
+
+    clock_t::time_point _last_receive;
+
+    std::map<EnumType, Channel> _channels;
+
+    /**
+     * Next message sequence of each channel.
+     */
+    std::uint16_t _next_sequence[2] = {0, 0};
+
+    /**
+     * Reliable datagrams by (sequence, fragment), until acknowledged.
+     */
+    pool_map_t<std::pair<std::uint16_t, std::uint16_t>, Unacked> _unacked;
+
+    /**
+     * Sequence of the oldest reliable message not fully acknowledged.
+     */
+    std::uint16_t _send_base = 0;
+
+    /**
+     * Reliable packets waiting for the send window to move.
+     */
+    std::deque<net::SharedPacket<EnumType>,
+               PoolAllocator<net::SharedPacket<EnumType>>>
+        _send_backlog;
+
+    /**
+     * Sequence of the next reliable message to deliver.
+     */
+    std::uint16_t _next_reliable = 0;
+
+    pool_map_t<std::uint16_t, Reassembly> _reliable_pending;
+
+    std::uint16_t _last_unreliable = 0;
+
+    bool _has_unreliable = false;
+
+    pool_map_t<std::uint16_t, Reassembly> _unreliable_pending;
+
+    std::array<std::uint8_t, 65536> _receive_buffer;
+
+    udp_endpoint_t _receive_sender;
+};
+
+} // namespace net
@@ -13,6 +13,7 @@ enum HarakaPackets : std::uint32_t {
     FULL_SNAPSHOT_RESULT = 6,  // response containing full snapshot update
     DELTA_SNAPSHOT_RESULT = 7, // sent by server at each new tick
     ACTION = 8,                // sent by user when making an action (changing direction, firing, spells)
+    SNAPSHOT_ACK = 9,          // sent by user with the last snapshot tick it received
 };
 
 }
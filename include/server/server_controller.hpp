@@ -4,32 +4,125 @@
 #include "net/server.hpp"
 #include "server/session_info.hpp"
 #include "server/serialization/server_serialization.pb.h"
+#include "util/arena.hpp"
+#include "util/thread_pool.hpp"
+#include "util/tick_scheduler.hpp"
+#include <google/protobuf/arena.h>
+#include <map>
+#include <optional>
 
 namespace server {
 
 /**
- * Server controller contains the game instance. It controls the game state with
- * actions provided from the network.
+ * Server controller contains the game instances. It controls the game states
+ * with actions provided from the network.
+ *
+ * A server hosts several independent game instances (matches, rooms, ...).
+ * Each logged client is routed to one of them and only receives its updates.
+ * The instances tick in parallel on a pool of worker threads.
  */
 class ServerController : public net::ServerInterface<HarakaPackets> {
 public:
-    ServerController(std::uint32_t tick_rate = 15, std::uint16_t port = 2049);
+    /**
+     * @param tick_rate, number of tick simulation per second.
+     * @param port, the TCP port to listen to.
+     * @param io_threads, number of threads handling the client connections.
+     * @param udp, also accepts UDP clients, which receive the delta updates
+     * on the unreliable channel.
+     * @param instance_count, number of game instances created at start.
+     * @param worker_threads, number of threads ticking the instances, 0 ticks
+     * them on the game loop thread.
+     */
+    ServerController(std::uint32_t tick_rate = 15,
+                     std::uint16_t port = 2049,
+                     std::size_t io_threads = 1,
+                     bool udp = false,
+                     std::size_t instance_count = 1,
+                     std::size_t worker_threads = 0);
 
     ~ServerController();
 
+    /**
+     * Ticks all the game instances in parallel, then sends the delta updates
+     * to the clients of each instance.
+     */
     void update_tick();
 
+    /**
+     * Creates a new game instance with an empty snapshot.
+     * @return the key of the instance.
+     */
+    util::slot_key_t create_instance();
+
+    /**
+     * Removes a game instance. Its clients are routed to the other instances
+     * at the next tick.
+     * @return false if there is no instance with this key.
+     */
+    bool remove_instance(util::slot_key_t key);
+
+    /**
+     * @return the game instance of a key, nullptr if there is none.
+     */
+    core::GameInstance* instance(util::slot_key_t key);
+
+    std::size_t instance_count() const;
+
+    /**
+     * @return the number of logged sessions routed to a game instance, 0 if
+     * there is no instance with this key.
+     */
+    std::size_t session_count(util::slot_key_t key) const;
+
+    /**
+     * Runs the game loop at the tick rate until stop_running() is called.
+     * Each tick dispatches the received packets, for half a tick at most,
+     * then updates the game instance and sends the delta updates.
+     */
+    void run();
+
+    /**
+     * Makes run() return after the current tick. Can be called from any
+     * thread.
+     */
+    void stop_running();
+
 protected:
     bool on_client_connect(
-        std::shared_ptr<net::TCPSession<HarakaPackets>> client) override;
+        std::shared_ptr<net::Session<HarakaPackets>> client) override;
 
     void on_client_disconnect(
-        std::shared_ptr<net::TCPSession<HarakaPackets>> client) override;
+        std::shared_ptr<net::Session<HarakaPackets>> client) override;
 
-    void on_message(std::shared_ptr<net::TCPSession<HarakaPackets>> client,
+    void on_message(std::shared_ptr<net::Session<HarakaPackets>> client,
                     net::Packet<HarakaPackets> packet) override;
 
 private:
+    /**
+     * A game instance and the results of its last tick.
+     */
+    struct Shard {
+        std::unique_ptr<core::GameInstance> instance;
+
+        /**
+         * Number of sessions routed to the instance.
+         */
+        std::size_t session_count = 0;
+
+        std::shared_ptr<core::DeltaSnapshot> delta;
+
+        std::vector<core::ActionStatus> status_list;
+
+        std::vector<std::shared_ptr<core::GameAction>> actions;
+
+        /**
+         * Encoded updates of the tick by baseline tick, shared without copy
+         * by the clients having acknowledged the same tick.
+         */
+        std::map<std::uint32_t, net::SharedPacket<HarakaPackets>> updates;
+
+        std::optional<net::SharedPacket<HarakaPackets>> full_snapshot;
+    };
 
     /**
      * Messages all the logged clients by checking the session info.
@@ -37,8 +130,8 @@ private:
      * @param exclude, a session that we eventually would like to exclude.
      */
     void _message_all_clients(
-        net::Packet<HarakaPackets> const& packet,
-        std::shared_ptr<net::TCPSession<HarakaPackets>> exclude = nullptr)
+        net::SharedPacket<HarakaPackets> const& packet,
+        std::shared_ptr<net::Session<HarakaPackets>> exclude = nullptr)
     {
         for (auto& session_info : _session_info) {
             if (session_info.logged()) {
@@ -54,21 +147,89 @@ private:
      * credentials and adds it to the Session info map.
      * @param connection_result
      */
-    void _parse_connection_result(std::shared_ptr<net::TCPSession<HarakaPackets>> client, net::Packet<HarakaPackets>& connection_result);
+    void _parse_connection_result(std::shared_ptr<net::Session<HarakaPackets>> client, net::Packet<HarakaPackets>& connection_result);
+
+    /**
+     * Returns the session info attached to a client session, through the
+     * user key of the session.
+     * @param client, the client session.
+     * @return a pointer in _session_info, nullptr if there is none.
+     */
+    SessionInfo* _find_session_info(
+        std::shared_ptr<net::Session<HarakaPackets>> const& client);
+
+    /**
+     * Erases the session info of the disconnected clients. Done after the
+     * tick as the clients disconnect while iterating over the session info.
+     */
+    void _erase_disconnected_session_info();
+
+    /**
+     * Routes a session to a game instance: the requested one if it exists,
+     * the instance with the fewest sessions otherwise.
+     * @param session_info, the client session info.
+     * @param requested, the key of the requested instance, or null_slot_key.
+     * @return the shard of the instance, nullptr if there is no instance.
+     */
+    Shard* _route_session(SessionInfo& session_info,
+                          util::slot_key_t requested = util::null_slot_key);
+
+    /**
+     * @return the shard a session is routed to, nullptr if its instance has
+     * been removed.
+     */
+    Shard* _find_shard(SessionInfo const& session_info);
+
+    /**
+     * Records the snapshot tick acknowledged by a client, the baseline of its
+     * next delta updates. Ticks that have not been simulated yet are ignored.
+     * @param session_info, the client session info.
+     * @param instance, the instance of the client.
+     * @param ack_packet, a SNAPSHOT_ACK packet.
+     */
+    void _parse_snapshot_ack(SessionInfo& session_info,
+                             core::GameInstance const& instance,
+                             net::Packet<HarakaPackets> const& ack_packet);
+
+    /**
+     * Sends a delta update to all the logged clients, from the last tick of
+     * their instance. Each client receives the difference between its last
+     * acknowledged snapshot and the current one, along with the actions of
+     * the new tick and their results.
+     *
+     * Clients sharing a baseline share the same encoded packet, the delta
+     * from the previous tick is the one already evaluated by the instance.
+     * Clients which never acknowledged a snapshot receive that delta as
+     * well, clients whose baseline is no longer in the instance history
+     * receive a full snapshot instead.
+     */
+    void _send_delta_updates();
 
     /**
-     * Sends a delta update to all the clients. This contains all the
-     * information such a the delta snapshotn, the actions related to the new
-     * tick as well as the action results.
-     * @param delta, a DeltaSnapshot object.
+     * Encodes a delta update packet.
+     * @param delta, the DeltaSnapshot to send.
      * @param status_list, a list of action status
      * @param actions, a list of GameAction pointers.
+     * @return a DELTA_SNAPSHOT_RESULT packet.
      */
-    void _send_delta_update(
+    net::Packet<HarakaPackets> _encode_delta_update(
         core::DeltaSnapshot const& delta,
         std::vector<core::ActionStatus> const& status_list,
         std::vector<std::shared_ptr<core::GameAction>> const& actions);
 
+    /**
+     * Encodes the current snapshot of an instance.
+     * @return a FULL_SNAPSHOT_RESULT packet.
+     */
+    net::Packet<HarakaPackets>
+    _encode_full_snapshot(core::GameInstance const& instance);
+
+    /**
+     * Releases the messages of the tick. The initial block of the arena is
+     * grown to the size the tick needed, so that the next ticks fit in it.
+     */
+    void _reset_message_arena();
+
     /**
      * Encodes the protocol buffer into a packet containing the serialized data
      * as well as the packet type.
@@ -98,12 +259,40 @@ private:
     }
 
     /**
-     * Reference to GameInstance, containing the game state and snapshots
+     * The game instances, containing the game states and snapshots, by key.
+     */
+    util::SlotMap<Shard> _shards;
+
+    /**
+     * Threads ticking the instances.
      */
-    core::GameInstance _instance;
+    util::ThreadPool _workers;
+
+    /**
+     * Allocates the data only living during a tick, like the deltas from
+     * older baselines. Reset at the end of each tick.
+     */
+    util::Arena _tick_arena;
+
+    /**
+     * Initial block of the message arena, kept by its resets.
+     */
+    std::vector<char> _message_arena_block;
+
+    /**
+     * Arena of the protobuf messages encoded during a tick, reset at the end
+     * of each tick.
+     */
+    std::unique_ptr<google::protobuf::Arena> _message_arena;
 
     // TODO create TSVector instead for thread safety
-    std::vector<SessionInfo> _session_info;
+    /**
+     * Session info of the logged clients, keyed by the user key of their
+     * session.
+     */
+    util::SlotMap<SessionInfo> _session_info;
+
+    util::TickScheduler _scheduler;
 
     std::uint32_t _current_tick = 0;
     const std::uint32_t _tick_rate = 15;
@@ -10,7 +10,7 @@ enum SessionStatus { DISCONNECTED = 0, LOGGED = 1 };
 
 class SessionInfo {
 public:
-    SessionInfo(std::shared_ptr<net::TCPSession<HarakaPackets>> const& session);
+    SessionInfo(std::shared_ptr<net::Session<HarakaPackets>> const& session);
 
     /**
      * Logs the session. Contacting the main server API to check credentials.
@@ -22,14 +22,46 @@ public:
      */
     bool log(std::string username,
              std::string token,
-             std::shared_ptr<net::TCPSession<HarakaPackets>> const&
+             std::shared_ptr<net::Session<HarakaPackets>> const&
                  reconnection = nullptr);
 
     void disconnect();
 
     [[nodiscard]] bool logged() const;
 
-    [[nodiscard]] std::shared_ptr<net::TCPSession<HarakaPackets>> session();
+    [[nodiscard]] std::shared_ptr<net::Session<HarakaPackets>>
+    session() const;
+
+    /**
+     * Records the last snapshot tick received by the client. Late or
+     * duplicated acknowledgements never move the baseline back.
+     * @param tick, the acknowledged tick.
+     */
+    void acknowledge(std::uint32_t tick);
+
+    /**
+     * @return true if the client acknowledged at least one snapshot.
+     */
+    [[nodiscard]] bool has_baseline() const;
+
+    /**
+     * @return the last snapshot tick acknowledged by the client, the baseline
+     * its delta updates are computed from.
+     */
+    [[nodiscard]] std::uint32_t acked_tick() const;
+
+    /**
+     * Routes the session to a game instance. Its baseline is reset, as the
+     * acknowledged ticks were from the previous instance.
+     * @param key, the key of the instance.
+     */
+    void set_instance(util::slot_key_t key);
+
+    /**
+     * @return the key of the game instance of the session, null_slot_key if
+     * it is not routed yet.
+     */
+    [[nodiscard]] util::slot_key_t instance() const;
 
 private:
     SessionStatus _status = DISCONNECTED;
@@ -38,7 +70,13 @@ private:
 
     std::string _token;
 
+    bool _has_baseline = false;
+
+    std::uint32_t _acked_tick = 0;
+
+    util::slot_key_t _instance = util::null_slot_key;
+
     // Pointer to the TCP session. !! Might be reset when the client disconnects
-    std::shared_ptr<net::TCPSession<HarakaPackets>> _session;
+    std::shared_ptr<net::Session<HarakaPackets>> _session;
 };
 } // namespace server
\ No newline at end of file
@@ -0,0 +1,114 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <vector>
+
+namespace util {
+
+/**
+ * Monotonic memory resource for the data living at most a tick (or as long
+ * as a history slot), released all at once by reset().
+ *
+ * Allocations bump a pointer in the current block and deallocations do
+ * nothing. reset() keeps the memory: if the previous cycle needed several
+ * blocks they are merged into a single one, so once the arena has grown to
+ * the size of a cycle, it no longer calls the global allocator.
+ *
+ * allocate() can be called concurrently (the workers of a parallel delta
+ * evaluation share the arena of the delta), reset() can't.
+ *
+ * Containers using the arena through a std::pmr::polymorphic_allocator keep
+ * it when moved, but copies fall back to the default resource. Anything
+ * outliving the next reset() must be copied out.
+ */
+class Arena : public std::pmr::memory_resource {
+public:
+    /**
+     * @param initial_size, size in bytes of the first block, allocated on
+     * the first allocation.
+     */
+    explicit Arena(std::size_t initial_size = 64 * 1024);
+
+    Arena(Arena const& other) = delete;
+
+    /**
+     * Releases all the allocations at once, keeping the memory for the next
+     * cycle.
+     */
+    void reset();
+
+    /**
+     * @return the number of bytes allocated since the last reset, alignment
+     * padding included.
+     */
+    std::size_t used() const;
+
+    /**
+     * @return the number of bytes held by the arena.
+     */
+    std::size_t capacity() const;
+
+    /**
+     * @return the number of blocks held by the arena, 1 in the steady state.
+     */
+    std::size_t block_count() const;
+
+protected:
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override;
+
+    void do_deallocate(void*, std::size_t, std::size_t) override
+    {
+        // released by reset()
+    }
+
+    bool do_is_equal(
+        std::pmr::memory_resource const& other) const noexcept override
+    {
+        return this == &other;
+    }
+
+private:
+    struct Block {
+        explicit Block(std::size_t size)
+            : data(new std::byte[size]), size(size)
+        {
+        }
+
+        std::unique_ptr<std::byte[]> data;
+
+        std::size_t size;
+
+        std::atomic<std::size_t> used{0};
+    };
+
+    /**
+     * Bumps the block offset.
+     * @return the allocated memory, nullptr if the block is full.
+     */
+    static void*
+    _try_allocate(Block& block, std::size_t bytes, std::size_t alignment);
+
+    /**
+     * @return the capacity, must be called with the mutex locked.
+     */
+    std::size_t _capacity() const;
+
+    /**
+     * Appends a block of at least min_size bytes and makes it the current
+     * one. Must be called with the mutex locked.
+     */
+    void _add_block(std::size_t min_size);
+
+    const std::size_t _initial_size;
+
+    std::vector<std::unique_ptr<Block>> _blocks;
+
+    std::atomic<Block*> _current{nullptr};
+
+    mutable std::mutex _mutex;
+};
+
+} // namespace util
@@ -0,0 +1,296 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <memory_resource>
+#include <stdexcept>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace util {
+
+/**
+ * Map from a 32 bits id to a value, stored as a vector of (id, value) pairs
+ * sorted by id. Iterations walk contiguous memory and copying the map is a
+ * single allocation, unlike a std::map which allocates a node per item.
+ *
+ * While the ids are dense (as the object ids given by a counter), an index
+ * vector maps each id to its position, making the lookups O(1). Ids too
+ * sparse to be indexed are looked up by binary search.
+ *
+ * Inserting or erasing anywhere else than at the end moves the following
+ * items and invalidates the iterators.
+ *
+ * Unlike std::map, there are no stable handles: any insertion or erasure
+ * may move the items, invalidating the pointers and references to the
+ * values as well. Code keeping an item across modifications must keep its
+ * id and look it up again.
+ *
+ * The items are allocated from a memory resource, given to the values too if
+ * they are allocator-aware. Like the pmr containers, copies use the default
+ * resource and moves keep the resource of the moved map.
+ *
+ * @tparam T the value type.
+ */
+template <typename T>
+class FlatMap {
+public:
+    typedef std::uint32_t key_type;
+
+    typedef T mapped_type;
+
+    typedef std::pair<key_type, T> value_type;
+
+    typedef typename std::pmr::vector<value_type>::iterator iterator;
+
+    typedef
+        typename std::pmr::vector<value_type>::const_iterator const_iterator;
+
+    FlatMap() = default;
+
+    explicit FlatMap(std::pmr::memory_resource* resource)
+        : _items(resource), _index(resource)
+    {
+    }
+
+    /**
+     * @return the memory resource of the items.
+     */
+    std::pmr::memory_resource* resource() const
+    {
+        return _items.get_allocator().resource();
+    }
+
+    /**
+     * @return the item of an id, end() if there is none.
+     */
+    iterator find(key_type key)
+    {
+        return _items.begin() + _position(key);
+    }
+
+    const_iterator find(key_type key) const
+    {
+        return _items.begin() + _position(key);
+    }
+
+    /**
+     * @return the first item whose id is not lower than the key.
+     */
+    iterator lower_bound(key_type key)
+    {
+        return std::lower_bound(_items.begin(), _items.end(), key, less_key);
+    }
+
+    const_iterator lower_bound(key_type key) const
+    {
+        return std::lower_bound(_items.begin(), _items.end(), key, less_key);
+    }
+
+    std::size_t count(key_type key) const
+    {
+        return find(key) != end() ? 1 : 0;
+    }
+
+    /**
+     * @return the value of an id, throws std::out_of_range if there is none.
+     */
+    T& at(key_type key)
+    {
+        auto it = find(key);
+        if (it == end()) {
+            throw std::out_of_range("FlatMap::at");
+        }
+        return it->second;
+    }
+
+    T const& at(key_type key) const
+    {
+        auto it = find(key);
+        if (it == end()) {
+            throw std::out_of_range("FlatMap::at");
+        }
+        return it->second;
+    }
+
+    /**
+     * @return the value of an id, default constructed if there was none.
+     */
+    T& operator[](key_type key)
+    {
+        return emplace(key).first->second;
+    }
+
+    /**
+     * Constructs the value of an id if there is none.
+     * @return the item of the id and true if it has been inserted.
+     */
+    template <typename... Args>
+    std::pair<iterator, bool> emplace(key_type key, Args&&... args)
+    {
+        auto it = find(key);
+        if (it != end()) {
+            return {it, false};
+        }
+        it = lower_bound(key);
+        auto position = static_cast<std::size_t>(it - _items.begin());
+        _items.emplace(it,
+                       std::piecewise_construct,
+                       std::forward_as_tuple(key),
+                       std::forward_as_tuple(std::forward<Args>(args)...));
+        _reindex(position, key);
+        return {_items.begin() + position, true};
+    }
+
+    std::pair<iterator, bool> insert(value_type value)
+    {
+        return emplace(value.first, std::move(value.second));
+    }
+
+    /**
+     * Same as emplace(), for compatibility with the std::map interface. The
+     * ids are usually inserted in increasing order, which is the fast path
+     * whatever the hint.
+     */
+    template <typename... Args>
+    iterator emplace_hint(const_iterator, key_type key, Args&&... args)
+    {
+        return emplace(key, std::forward<Args>(args)...).first;
+    }
+
+    /**
+     * @return the number of erased items, 0 or 1.
+     */
+    std::size_t erase(key_type key)
+    {
+        auto it = find(key);
+        if (it == end()) {
+            return 0;
+        }
+        erase(it);
+        return 1;
+    }
+
+    /**
+     * @return the iterator following the erased item.
+     */
+    iterator erase(const_iterator it)
+    {
+        auto position = static_cast<std::size_t>(it - _items.cbegin());
+        auto key = it->first;
+        _items.erase(_items.begin() + position);
+        if (key < _index.size()) {
+            _index[key] = 0;
+            _reindex(position, key);
+        }
+        return _items.begin() + position;
+    }
+
+    void reserve(std::size_t size)
+    {
+        _items.reserve(size);
+    }
+
+    void clear()
+    {
+        _items.clear();
+        _index.clear();
+    }
+
+    std::size_t size() const
+    {
+        return _items.size();
+    }
+
+    bool empty() const
+    {
+        return _items.empty();
+    }
+
+    iterator begin()
+    {
+        return _items.begin();
+    }
+
+    iterator end()
+    {
+        return _items.end();
+    }
+
+    const_iterator begin() const
+    {
+        return _items.begin();
+    }
+
+    const_iterator end() const
+    {
+        return _items.end();
+    }
+
+    bool operator==(FlatMap const& other) const
+    {
+        return _items == other._items;
+    }
+
+    bool operator!=(FlatMap const& other) const
+    {
+        return _items != other._items;
+    }
+
+private:
+    static bool less_key(value_type const& item, key_type key)
+    {
+        return item.first < key;
+    }
+
+    /**
+     * @return the position of an id in _items, size() if there is none.
+     */
+    std::size_t _position(key_type key) const
+    {
+        if (key < _index.size()) {
+            return _index[key] != 0 ? _index[key] - 1 : _items.size();
+        }
+        auto it = lower_bound(key);
+        return it != _items.end() && it->first == key
+                   ? static_cast<std::size_t>(it - _items.begin())
+                   : _items.size();
+    }
+
+    /**
+     * Updates the index after an insertion or an erasure at a position: the
+     * following items have moved. Grows the index to cover the key while the
+     * ids stay dense enough (the index is at most about twice as large as
+     * the map).
+     */
+    void _reindex(std::size_t position, key_type key)
+    {
+        if (key >= _index.size()) {
+            std::size_t limit = 2 * _items.size() + 64;
+            if (key >= limit) {
+                return;
+            }
+            _index.assign(std::min<std::size_t>(
+                              std::max<std::size_t>(key + 1, 2 * _index.size()),
+                              limit),
+                          0);
+            position = 0;
+        }
+        for (auto i = position; i < _items.size(); i++) {
+            if (_items[i].first >= _index.size()) {
+                break;
+            }
+            _index[_items[i].first] = static_cast<std::uint32_t>(i + 1);
+        }
+    }
+
+    std::pmr::vector<value_type> _items;
+
+    /**
+     * Position + 1 of the item of each id lower than its size, 0 if there is
+     * no item for the id.
+     */
+    std::pmr::vector<std::uint32_t> _index;
+};
+
+} // namespace util
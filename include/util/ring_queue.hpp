@@ -0,0 +1,349 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace util {
+
+/**
+ * Lets a consumer sleep on an empty queue without making the producers pay
+ * for it: producers only take the mutex when a consumer is waiting.
+ */
+class QueueWaiter {
+public:
+    /**
+     * Blocks until the predicate returns true.
+     * @param ready, returns true when the queue has items.
+     */
+    template <typename Predicate>
+    void wait(Predicate&& ready)
+    {
+        if (ready()) {
+            return;
+        }
+        std::unique_lock<std::mutex> lock(_mutex);
+        _waiting.store(true);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        _condition.wait(lock, ready);
+        _waiting.store(false, std::memory_order_relaxed);
+    }
+
+    /**
+     * Wakes the waiting consumer up, if any. Called after each push.
+     */
+    void notify()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (_waiting.load()) {
+            std::scoped_lock lock(_mutex);
+            _condition.notify_one();
+        }
+    }
+
+private:
+    std::atomic<bool> _waiting{false};
+    std::mutex _mutex;
+    std::condition_variable _condition;
+};
+
+/**
+ * @return the smallest power of two greater or equal to value.
+ */
+inline std::size_t ring_capacity(std::size_t value)
+{
+    std::size_t capacity = 1;
+    while (capacity < value) {
+        capacity <<= 1;
+    }
+    return capacity;
+}
+
+/**
+ * Bounded lock-free multiple producers, single consumer queue.
+ *
+ * Each cell of the ring holds a sequence number telling whether it is free
+ * for the push of a given position or ready for its pop, so producers only
+ * contend on one atomic counter and never on the consumer.
+ *
+ * @tparam T the item type, must be default constructible and movable.
+ */
+template <typename T>
+class MPSCRingQueue {
+public:
+    /**
+     * @param capacity, the maximum number of items, rounded up to a power of
+     * two.
+     */
+    explicit MPSCRingQueue(std::size_t capacity = 1024)
+        : _mask(ring_capacity(capacity) - 1),
+          _cells(std::make_unique<Cell[]>(_mask + 1))
+    {
+        for (std::size_t i = 0; i <= _mask; i++) {
+            _cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    MPSCRingQueue(MPSCRingQueue const& other) = delete;
+
+    /**
+     * Pushes an item if the queue is not full. Can be called from any thread.
+     * @param item, the item to push.
+     * @return false if the queue is full, the item is then left untouched.
+     */
+    bool try_push(T&& item)
+    {
+        Cell* cell;
+        auto position = _tail.load(std::memory_order_relaxed);
+        for (;;) {
+            cell = &_cells[position & _mask];
+            auto sequence = cell->sequence.load(std::memory_order_acquire);
+            auto difference = static_cast<std::intptr_t>(sequence)
+                              - static_cast<std::intptr_t>(position);
+            if (difference == 0) {
+                if (_tail.compare_exchange_weak(
+                        position, position + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            }
+            else if (difference < 0) {
+                return false;
+            }
+            else {
+                position = _tail.load(std::memory_order_relaxed);
+            }
+        }
+        cell->value = std::move(item);
+        cell->sequence.store(position + 1, std::memory_order_release);
+        _waiter.notify();
+        return true;
+    }
+
+    bool try_push(T const& item)
+    {
+        T copy(item);
+        return try_push(std::move(copy));
+    }
+
+    /**
+     * Pushes an item, yielding until the consumer makes room if the queue is
+     * full. Must not be called from the consumer thread.
+     * @param item, the item to push.
+     */
+    void push(T item)
+    {
+        while (!try_push(std::move(item))) {
+            std::this_thread::yield();
+        }
+    }
+
+    /**
+     * Pops the oldest item. Consumer thread only.
+     * @param item, receives the popped item.
+     * @return false if the queue is empty.
+     */
+    bool try_pop(T& item)
+    {
+        auto position = _head.load(std::memory_order_relaxed);
+        auto& cell = _cells[position & _mask];
+        auto sequence = cell.sequence.load(std::memory_order_acquire);
+        if (sequence != position + 1) {
+            return false;
+        }
+        item = std::move(cell.value);
+        cell.value = T();
+        cell.sequence.store(position + _mask + 1, std::memory_order_release);
+        _head.store(position + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    /**
+     * Pops up to max_items items and passes them to the function, in order.
+     * Consumer thread only.
+     * @param func, a callable taking a T&&.
+     * @param max_items, the maximum number of items to pop.
+     * @return the number of popped items.
+     */
+    template <typename F>
+    std::size_t drain(F&& func, std::size_t max_items = -1)
+    {
+        std::size_t count = 0;
+        T item;
+        while (count < max_items && try_pop(item)) {
+            func(std::move(item));
+            count++;
+        }
+        return count;
+    }
+
+    /**
+     * @return true if there is no item ready for the consumer.
+     */
+    bool empty() const
+    {
+        auto position = _head.load(std::memory_order_relaxed);
+        return _cells[position & _mask].sequence.load(
+                   std::memory_order_acquire)
+               != position + 1;
+    }
+
+    /**
+     * Blocks the consumer until an item is available.
+     */
+    void wait()
+    {
+        _waiter.wait([this]() { return !empty(); });
+    }
+
+    std::size_t capacity() const
+    {
+        return _mask + 1;
+    }
+
+private:
+    struct Cell {
+        std::atomic<std::size_t> sequence;
+        T value;
+    };
+
+    const std::size_t _mask;
+
+    std::unique_ptr<Cell[]> _cells;
+
+    alignas(64) std::atomic<std::size_t> _tail{0};
+
+    alignas(64) std::atomic<std::size_t> _head{0};
+
+    QueueWaiter _waiter;
+};
+
+/**
+ * Bounded lock-free single producer, single consumer queue. Cheaper than
+ * MPSCRingQueue when only one thread pushes.
+ *
+ * @tparam T the item type, must be default constructible and movable.
+ */
+template <typename T>
+class SPSCRingQueue {
+public:
+    /**
+     * @param capacity, the maximum number of items, rounded up to a power of
+     * two.
+     */
+    explicit SPSCRingQueue(std::size_t capacity = 1024)
+        : _mask(ring_capacity(capacity) - 1),
+          _items(std::make_unique<T[]>(_mask + 1))
+    {
+    }
+
+    SPSCRingQueue(SPSCRingQueue const& other) = delete;
+
+    /**
+     * Pushes an item if the queue is not full. Producer thread only.
+     * @param item, the item to push.
+     * @return false if the queue is full, the item is then left untouched.
+     */
+    bool try_push(T&& item)
+    {
+        auto position = _tail.load(std::memory_order_relaxed);
+        if (position - _head.load(std::memory_order_acquire) > _mask) {
+            return false;
+        }
+        _items[position & _mask] = std::move(item);
+        _tail.store(position + 1, std::memory_order_release);
+        _waiter.notify();
+        return true;
+    }
+
+    bool try_push(T const& item)
+    {
+        T copy(item);
+        return try_push(std::move(copy));
+    }
+
+    /**
+     * Pushes an item, yielding until the consumer makes room if the queue is
+     * full. Producer thread only.
+     * @param item, the item to push.
+     */
+    void push(T item)
+    {
+        while (!try_push(std::move(item))) {
+            std::this_thread::yield();
+        }
+    }
+
+    /**
+     * Pops the oldest item. Consumer thread only.
+     * @param item, receives the popped item.
+     * @return false if the queue is empty.
+     */
+    bool try_pop(T& item)
+    {
+        auto position = _head.load(std::memory_order_relaxed);
+        if (position == _tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        item = std::move(_items[position & _mask]);
+        _items[position & _mask] = T();
+        _head.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Pops up to max_items items and passes them to the function, in order.
+     * Consumer thread only.
+     * @param func, a callable taking a T&&.
+     * @param max_items, the maximum number of items to pop.
+     * @return the number of popped items.
+     */
+    template <typename F>
+    std::size_t drain(F&& func, std::size_t max_items = -1)
+    {
+        std::size_t count = 0;
+        T item;
+        while (count < max_items && try_pop(item)) {
+            func(std::move(item));
+            count++;
+        }
+        return count;
+    }
+
+    /**
+     * @return true if there is no item ready for the consumer.
+     */
+    bool empty() const
+    {
+        return _head.load(std::memory_order_relaxed)
+               == _tail.load(std::memory_order_acquire);
+    }
+
+    /**
+     * Blocks the consumer until an item is available.
+     */
+    void wait()
+    {
+        _waiter.wait([this]() { return !empty(); });
+    }
+
+    std::size_t capacity() const
+    {
+        return _mask + 1;
+    }
+
+private:
+    const std::size_t _mask;
+
+    std::unique_ptr<T[]> _items;
+
+    alignas(64) std::atomic<std::size_t> _tail{0};
+
+    alignas(64) std::atomic<std::size_t> _head{0};
+
+    QueueWaiter _waiter;
+};
+
+} // namespace util
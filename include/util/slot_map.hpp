@@ -0,0 +1,229 @@
+#pragma once
+#include <cassert>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace util {
+
+/**
+ * Key of a value in a SlotMap: the slot index in the low 32 bits, the
+ * generation of the slot in the high 32 bits.
+ */
+typedef std::uint64_t slot_key_t;
+
+/**
+ * Key never returned by a SlotMap.
+ */
+constexpr slot_key_t null_slot_key = 0;
+
+/**
+ * Associative container giving O(1) insertion, lookup and removal through
+ * generation-checked keys, while keeping its values packed in a vector for
+ * the iterations.
+ *
+ * Each slot stores the index of its value in the dense vector. Removing a
+ * value moves the last one in its place and bumps the generation of the slot,
+ * so the keys of removed values are never resolved again, even once their
+ * slot is reused. Any key can be looked up, keys read from the network
+ * included: a key only resolves if its slot is used.
+ *
+ * @tparam T the value type, must be movable.
+ */
+template <typename T>
+class SlotMap {
+public:
+    typedef typename std::vector<T>::iterator iterator;
+
+    typedef typename std::vector<T>::const_iterator const_iterator;
+
+    /**
+     * Constructs a value in a free slot.
+     * @param args, the value constructor arguments.
+     * @return the key of the value.
+     */
+    template <typename... Args>
+    slot_key_t emplace(Args&&... args)
+    {
+        std::uint32_t slot_index;
+        if (_free_head != no_slot) {
+            slot_index = _free_head;
+            _free_head = _slots[slot_index].index;
+        }
+        else {
+            slot_index = static_cast<std::uint32_t>(_slots.size());
+            _slots.push_back(Slot{});
+        }
+
+        auto& slot = _slots[slot_index];
+        slot.index = static_cast<std::uint32_t>(_values.size());
+        _values.emplace_back(std::forward<Args>(args)...);
+        _value_slots.push_back(slot_index);
+        return make_key(slot_index, slot.generation);
+    }
+
+    slot_key_t insert(T value)
+    {
+        return emplace(std::move(value));
+    }
+
+    /**
+     * Removes the value of a key.
+     * @return false if the key doesn't refer to a value.
+     */
+    bool erase(slot_key_t key)
+    {
+        if (!contains(key)) {
+            return false;
+        }
+        auto slot_index = key_index(key);
+        auto& slot = _slots[slot_index];
+
+        // moves the last value in the hole to keep the values packed
+        auto index = slot.index;
+        auto last = static_cast<std::uint32_t>(_values.size() - 1);
+        if (index != last) {
+            _values[index] = std::move(_values[last]);
+            _value_slots[index] = _value_slots[last];
+            _slots[_value_slots[index]].index = index;
+        }
+        _values.pop_back();
+        _value_slots.pop_back();
+
+        // generation 0 is skipped so that no key equals null_slot_key
+        if (++slot.generation == 0) {
+            slot.generation = 1;
+        }
+        slot.index = _free_head;
+        _free_head = slot_index;
+        return true;
+    }
+
+    /**
+     * @return the value of a key, nullptr if the key doesn't refer to a value
+     * anymore.
+     */
+    T* get(slot_key_t key)
+    {
+        return contains(key) ? &_values[_slots[key_index(key)].index]
+                             : nullptr;
+    }
+
+    T const* get(slot_key_t key) const
+    {
+        return contains(key) ? &_values[_slots[key_index(key)].index]
+                             : nullptr;
+    }
+
+    /**
+     * @return true if the key refers to a value.
+     */
+    bool contains(slot_key_t key) const
+    {
+        auto slot_index = key_index(key);
+        if (slot_index >= _slots.size()) {
+            return false;
+        }
+        // the keys can come from the network: the current generation of a
+        // free slot is rejected too, its index being a free list link
+        auto const& slot = _slots[slot_index];
+        return slot.generation == key_generation(key)
+               && slot.index < _value_slots.size()
+               && _value_slots[slot.index] == slot_index;
+    }
+
+    /**
+     * @return the key of the value at a position of the iteration.
+     */
+    slot_key_t key_at(std::size_t position) const
+    {
+#ifndef NDEBUG
+        assert(position < _values.size());
+#endif
+        auto slot_index = _value_slots[position];
+        return make_key(slot_index, _slots[slot_index].generation);
+    }
+
+    std::size_t size() const
+    {
+        return _values.size();
+    }
+
+    bool empty() const
+    {
+        return _values.empty();
+    }
+
+    /**
+     * Removes all the values, their keys are invalidated.
+     */
+    void clear()
+    {
+        while (!_values.empty()) {
+            erase(key_at(_values.size() - 1));
+        }
+    }
+
+    /**
+     * Iterates over the values, in no particular order.
+     */
+    iterator begin()
+    {
+        return _values.begin();
+    }
+
+    iterator end()
+    {
+        return _values.end();
+    }
+
+    const_iterator begin() const
+    {
+        return _values.begin();
+    }
+
+    const_iterator end() const
+    {
+        return _values.end();
+    }
+
+private:
+    static constexpr std::uint32_t no_slot = 0xFFFFFFFF;
+
+    struct Slot {
+        std::uint32_t generation = 1;
+
+        /**
+         * Index of the value if the slot is used, next free slot otherwise.
+         */
+        std::uint32_t index = no_slot;
+    };
+
+    static slot_key_t make_key(std::uint32_t index, std::uint32_t generation)
+    {
+        return (static_cast<slot_key_t>(generation) << 32) | index;
+    }
+
+    static std::uint32_t key_index(slot_key_t key)
+    {
+        return static_cast<std::uint32_t>(key);
+    }
+
+    static std::uint32_t key_generation(slot_key_t key)
+    {
+        return static_cast<std::uint32_t>(key >> 32);
+    }
+
+    std::vector<Slot> _slots;
+
+    std::vector<T> _values;
+
+    /**
+     * Slot index of each value.
+     */
+    std::vector<std::uint32_t> _value_slots;
+
+    std::uint32_t _free_head = no_slot;
+};
+
+} // namespace util
@@ -0,0 +1,57 @@
+#pragma once
+#include <cstddef>
+
+namespace util {
+
+/**
+ * Non-owning view over a contiguous range of items, a minimal stand-in for
+ * C++20 std::span.
+ *
+ * @tparam T the item type.
+ */
+template <typename T>
+class Span {
+public:
+    Span() = default;
+
+    Span(T* data, std::size_t size) : _data(data), _size(size)
+    {
+    }
+
+    T* begin() const
+    {
+        return _data;
+    }
+
+    T* end() const
+    {
+        return _data + _size;
+    }
+
+    T* data() const
+    {
+        return _data;
+    }
+
+    T& operator[](std::size_t index) const
+    {
+        return _data[index];
+    }
+
+    std::size_t size() const
+    {
+        return _size;
+    }
+
+    bool empty() const
+    {
+        return _size == 0;
+    }
+
+private:
+    T* _data = nullptr;
+
+    std::size_t _size = 0;
+};
+
+} // namespace util
@@ -0,0 +1,137 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace util {
+
+/**
+ * Fixed pool of worker threads running tasks from a shared queue.
+ *
+ * parallel_for() splits an index range over the workers and the calling
+ * thread. A thread waiting for a parallel_for() runs the queued tasks in the
+ * meantime, so parallel_for() can be nested from inside a task without
+ * starving the pool.
+ */
+class ThreadPool {
+public:
+    /**
+     * @param thread_count, number of worker threads, 0 runs everything on
+     * the calling threads.
+     */
+    explicit ThreadPool(std::size_t thread_count =
+                            std::thread::hardware_concurrency());
+
+    ThreadPool(ThreadPool const& other) = delete;
+
+    /**
+     * Runs the remaining tasks then joins the workers.
+     */
+    ~ThreadPool();
+
+    /**
+     * Queues a task, run by the first free worker.
+     */
+    void submit(std::function<void()> task);
+
+    /**
+     * Calls func(i) for each i in [0, count) over the workers and the calling
+     * thread, and returns once all the calls are done. The first exception
+     * thrown by func is rethrown.
+     * @param count, the number of indices.
+     * @param func, a callable taking a std::size_t index.
+     * @param grain, number of consecutive indices taken at once by a thread.
+     */
+    template <typename F>
+    void parallel_for(std::size_t count, F&& func, std::size_t grain = 1)
+    {
+        if (count == 0) {
+            return;
+        }
+        grain = grain == 0 ? 1 : grain;
+        auto chunk_count = (count + grain - 1) / grain;
+
+        ForState state;
+        auto run_chunks = [&]() {
+            std::size_t chunk;
+            while ((chunk = state.next_chunk.fetch_add(1)) < chunk_count) {
+                auto end = std::min(count, (chunk + 1) * grain);
+                try {
+                    for (auto i = chunk * grain; i < end; i++) {
+                        func(i);
+                    }
+                }
+                catch (...) {
+                    std::scoped_lock lock(state.mutex);
+                    if (!state.exception) {
+                        state.exception = std::current_exception();
+                    }
+                }
+            }
+        };
+
+        // one helper per worker at most, the calling thread takes a share
+        auto helpers = std::min(_workers.size(), chunk_count - 1);
+        state.running_helpers.store(helpers);
+        for (std::size_t i = 0; i < helpers; i++) {
+            submit([&state, &run_chunks]() {
+                run_chunks();
+                state.running_helpers.fetch_sub(1);
+            });
+        }
+
+        run_chunks();
+        while (state.running_helpers.load() > 0) {
+            if (!_run_pending_task()) {
+                std::this_thread::yield();
+            }
+        }
+
+        if (state.exception) {
+            std::rethrow_exception(state.exception);
+        }
+    }
+
+    /**
+     * @return the number of worker threads.
+     */
+    std::size_t size() const;
+
+private:
+    struct ForState {
+        std::atomic<std::size_t> next_chunk{0};
+
+        std::atomic<std::size_t> running_helpers{0};
+
+        std::mutex mutex;
+
+        std::exception_ptr exception;
+    };
+
+    /**
+     * Runs a queued task on the calling thread, if any.
+     * @return false if the queue was empty.
+     */
+    bool _run_pending_task();
+
+    void _work();
+
+    std::vector<std::thread> _workers;
+
+    std::deque<std::function<void()>> _tasks;
+
+    std::mutex _mutex;
+
+    std::condition_variable _condition;
+
+    bool _stopping = false;
+};
+
+} // namespace util
@@ -0,0 +1,137 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+namespace util {
+
+/**
+ * Runs a function at a fixed rate on the monotonic clock.
+ *
+ * The ticks follow an absolute schedule (start + n * period) so the time
+ * spent in the ticks and the sleep inaccuracies don't accumulate. Late ticks
+ * are run back to back to catch up, at most max_catch_up in a row. When the
+ * scheduler is further behind, the missed ticks are dropped instead of
+ * slowing the next ones down.
+ *
+ * Between the ticks the thread sleeps, then spins the last spin_threshold
+ * before the deadline as the sleep wakes up late.
+ */
+class TickScheduler {
+public:
+    typedef std::chrono::steady_clock clock_t;
+
+    /**
+     * @param tick_rate, number of ticks per second.
+     * @param max_catch_up, maximum number of ticks run in a row when late.
+     * @param spin_threshold, time before a deadline spent spinning.
+     */
+    explicit TickScheduler(
+        std::uint32_t tick_rate,
+        std::uint32_t max_catch_up = 5,
+        clock_t::duration spin_threshold = std::chrono::milliseconds(1))
+        : _period(std::chrono::duration_cast<clock_t::duration>(
+              std::chrono::duration<double>(1.0 / tick_rate))),
+          _max_catch_up(max_catch_up),
+          _spin_threshold(spin_threshold)
+    {
+    }
+
+    TickScheduler(TickScheduler const& other) = delete;
+
+    /**
+     * Runs the ticks until stop() is called, starting with one right away.
+     * @param tick, a callable taking the deadline of the tick, which is the
+     * time the next tick is due at.
+     */
+    template <typename F>
+    void run(F&& tick)
+    {
+        auto next_tick = clock_t::now();
+        while (!_stop_requested.load(std::memory_order_relaxed)) {
+            auto now = clock_t::now();
+            for (std::uint32_t i = 0; i < _max_catch_up && now >= next_tick;
+                 i++) {
+                next_tick += _period;
+                tick(next_tick);
+                _tick_count.fetch_add(1, std::memory_order_relaxed);
+                if (_stop_requested.load(std::memory_order_relaxed)) {
+                    break;
+                }
+                now = clock_t::now();
+            }
+            if (_stop_requested.load(std::memory_order_relaxed)) {
+                break;
+            }
+
+            if (now >= next_tick) {
+                // too late to catch up, drops the missed ticks
+                auto missed = (now - next_tick) / _period + 1;
+                next_tick += missed * _period;
+                _skipped_ticks.fetch_add(missed, std::memory_order_relaxed);
+            }
+            wait_until(next_tick);
+        }
+        _stop_requested.store(false, std::memory_order_relaxed);
+    }
+
+    /**
+     * Makes run() return after the current tick. Can be called from any
+     * thread, or from the tick itself.
+     */
+    void stop()
+    {
+        _stop_requested.store(true, std::memory_order_relaxed);
+    }
+
+    /**
+     * Sleeps until close to the deadline, then spins until it is reached.
+     */
+    void wait_until(clock_t::time_point deadline) const
+    {
+        auto now = clock_t::now();
+        if (deadline - now > _spin_threshold) {
+            std::this_thread::sleep_until(deadline - _spin_threshold);
+        }
+        while (clock_t::now() < deadline) {
+            std::this_thread::yield();
+        }
+    }
+
+    clock_t::duration period() const
+    {
+        return _period;
+    }
+
+    /**
+     * @return the number of ticks run.
+     */
+    std::uint64_t tick_count() const
+    {
+        return _tick_count.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @return the number of ticks dropped because the scheduler was too late.
+     */
+    std::uint64_t skipped_ticks() const
+    {
+        return _skipped_ticks.load(std::memory_order_relaxed);
+    }
+
+private:
+    const clock_t::duration _period;
+
+    const std::uint32_t _max_catch_up;
+
+    const clock_t::duration _spin_threshold;
+
+    std::atomic<bool> _stop_requested{false};
+
+    std::atomic<std::uint64_t> _tick_count{0};
+
+    std::atomic<std::uint64_t> _skipped_ticks{0};
+};
+
+} // namespace util
@@ -17,15 +17,19 @@ core::GameAction::registry_map& core::GameAction::registry()
 core::serialization::Action core::GameAction::serialize() const
 {
     serialization::Action action;
-    action.set_id(_id);
-    action.set_type_name(type_name());
+    serialize_to(&action);
+    return action;
+}
 
-    auto& value_map = *action.mutable_values();
-    for (auto const& value_pair : _values) {
-        value_map[value_pair.first] = value_pair.second->serialize();
-    }
+void core::GameAction::serialize_to(core::serialization::Action* action) const
+{
+    action->set_id(_id);
+    action->set_type_name(type_name());
 
-    return action;
+    auto& value_map = *action->mutable_values();
+    for (field_id_t field = 0; field < _values.size(); field++) {
+        value_map[_values.schema()->name(field)] = _values[field]->serialize();
+    }
 }
 
 std::unique_ptr<core::GameAction>
@@ -39,9 +43,9 @@ core::GameAction::deserialize(const core::serialization::Action& buffer)
     new_action->add_values();
 
     for (auto const& value_pair : value_dict) {
-        auto old_value_ptr = new_action->_values[value_pair.first];
+        auto* old_value_ptr = new_action->_values.at(value_pair.first);
         auto deserialized_value = old_value_ptr->deserialize(value_pair.second);
-        old_value_ptr->change(deserialized_value);
+        old_value_ptr->change(*deserialized_value);
     }
 
     return new_action;
@@ -60,14 +64,18 @@ core::GameAction::instantiate(const std::string& type)
 core::serialization::ActionStatus core::ActionStatus::serialize() const
 {
     serialization::ActionStatus buffer;
-
-    buffer.set_id(action_id);
-    buffer.set_success(success);
-    buffer.set_message(message);
-
+    serialize_to(&buffer);
     return buffer;
 }
 
+void core::ActionStatus::serialize_to(
+    core::serialization::ActionStatus* buffer) const
+{
+    buffer->set_id(action_id);
+    buffer->set_success(success);
+    buffer->set_message(message);
+}
+
 core::ActionStatus
 core::ActionStatus::deserialize(serialization::ActionStatus const& buffer)
 {
@@ -85,8 +93,7 @@ core::serialize_action_status_list(const std::vector<ActionStatus>& status_list)
 {
     core::serialization::ActionStatusList list;
     for (auto const& elem : status_list) {
-        auto* serialized_status = list.add_status();
-        *serialized_status = elem.serialize();
+        elem.serialize_to(list.add_status());
     }
     return list;
 }
@@ -15,32 +15,31 @@ core::GameObject::interpolate(diffset_t const& differences, float interp)
 {
     auto new_object = clone();
     for (auto const& value : differences) {
-        auto object_value = new_object->_values[value.first];
+        auto* object_value = new_object->_values[value.first];
         auto interpolated_value =
             object_value->interp(value.second.get(), interp);
-        object_value->change(interpolated_value);
+        object_value->change(*interpolated_value);
     }
     return new_object;
 }
 
-core::diffset_t core::GameObject::compare(const core::GameObject* other) const
+core::diffset_t
+core::GameObject::compare(const core::GameObject* other,
+                          std::pmr::memory_resource* resource) const
 {
-    diffset_t diffset;
-
-    auto it = _values.begin();
-    while (it != _values.end()) {
-        auto value_name = it->first;
-        auto* value = it->second;
-        auto* other_value = other->_values.at(value_name);
+    diffset_t diffset(_values.schema(), resource);
 #ifndef NDEBUG
-        // value should normally never be nullptr
-        // other_value might be null ptr if two compared object are not the
-        // same.
-        assert(other_value != nullptr);
+    // two compared objects must be of the same type
+    assert(_values.size() == 0 || _values.schema() == other->_values.schema());
 #endif
-        auto delta_value = value->get_delta(other_value);
-        diffset.insert({value_name, delta_value});
-        it++;
+
+    diffset.reserve(_values.size());
+    for (field_id_t field = 0; field < _values.size(); field++) {
+        auto delta = _values[field]->get_delta(other->_values[field]);
+        // unchanged fields are left out
+        if (!delta->is_zero()) {
+            diffset.insert(field, std::move(delta));
+        }
     }
 
     return diffset;
@@ -56,6 +55,20 @@ core::GameObject::get_value(std::string const& name) const
     return value;
 }
 
+const core::GameValue* core::GameObject::get_value(field_id_t field) const
+{
+    GameValue const* value = _values[field];
+#ifndef NDEBUG
+    assert(value != nullptr);
+#endif
+    return value;
+}
+
+core::ValueSchema const* core::GameObject::schema() const
+{
+    return _values.schema();
+}
+
 std::uint32_t core::GameObject::id() const
 {
     return _id;
@@ -64,28 +77,87 @@ std::uint32_t core::GameObject::id() const
 std::uint32_t core::GameObject::checksum() const
 {
     boost::crc_32_type sum;
-    for (const auto& it : _values) {
-        std::uint32_t object_checksum = it.second->checksum();
+    for (field_id_t field = 0; field < _values.size(); field++) {
+        std::uint32_t object_checksum = _values[field]->checksum();
         sum.process_bytes(&object_checksum, sizeof(std::uint32_t));
     }
     return sum.checksum();
 }
 
-core::serialization::GameObject core::GameObject::serialize() const
+std::size_t core::GameObject::values_byte_size() const
 {
-    core::serialization::GameObject serialized;
-    serialized.set_id(_id);
+    std::size_t size = 0;
+    for (field_id_t field = 0; field < _values.size(); field++) {
+        size += _values[field]->byte_size();
+    }
+    return size;
+}
+
+void core::GameObject::write_values(core::ByteWriter& writer) const
+{
+    for (field_id_t field = 0; field < _values.size(); field++) {
+        _values[field]->write(writer);
+    }
+}
+
+void core::GameObject::read_values(core::ByteReader& reader)
+{
+    for (field_id_t field = 0; field < _values.size(); field++) {
+        _values[field]->read(reader);
+    }
+}
 
-    serialized.set_type_name(type_name());
+void core::GameObject::pack(core::BitWriter& writer) const
+{
+    auto name = type_name();
+    writer.write_varint(name.size());
+    writer.write_bytes(name.data(), name.size());
+    for (field_id_t field = 0; field < _values.size(); field++) {
+        _values[field]->pack(writer, nullptr);
+    }
+}
 
-    auto& serialized_map = *serialized.mutable_values();
-    for (const auto& value_pair : _values) {
-        serialized_map[value_pair.first] = value_pair.second->serialize();
+std::unique_ptr<core::GameObject>
+core::GameObject::unpack(core::BitReader& reader, std::uint32_t id)
+{
+    // the length comes from the network, checked before allocating
+    auto name_size = reader.read_varint();
+    if (name_size > reader.remaining() || name_size > max_type_name_size) {
+        throw BufferOverflowException("Invalid object type name length.");
     }
+    std::string name(name_size, '\0');
+    reader.read_bytes(name.data(), name.size());
+
+    auto new_object = core::GameObject::instantiate(name);
+    new_object->_id = id;
+    new_object->add_values();
+    for (field_id_t field = 0; field < new_object->_values.size(); field++) {
+        new_object->_values[field]->unpack(reader, nullptr);
+    }
+    return new_object;
+}
 
+core::serialization::GameObject core::GameObject::serialize() const
+{
+    core::serialization::GameObject serialized;
+    serialize_to(&serialized);
     return serialized;
 }
 
+void core::GameObject::serialize_to(
+    core::serialization::GameObject* object) const
+{
+    object->set_id(_id);
+
+    object->set_type_name(type_name());
+
+    // values are written directly in the message buffer
+    auto& packed_values = *object->mutable_packed_values();
+    packed_values.resize(values_byte_size());
+    ByteWriter writer(packed_values.data(), packed_values.size());
+    write_values(writer);
+}
+
 std::unique_ptr<core::GameObject>
 core::GameObject::deserialize(core::serialization::GameObject const& object)
 {
@@ -96,10 +168,17 @@ core::GameObject::deserialize(core::serialization::GameObject const& object)
 
     new_object->add_values();
 
+    if (!object.packed_values().empty()) {
+        ByteReader reader(object.packed_values().data(),
+                          object.packed_values().size());
+        new_object->read_values(reader);
+    }
+
+    // objects serialized by name
     for (auto it = values_dict.begin(); it != values_dict.end(); it++) {
-        auto value = new_object->_values[it->first]->deserialize(it->second);
-        auto old_value_ptr = new_object->_values[it->first];
-        old_value_ptr->change(value);
+        auto* old_value_ptr = new_object->_values.at(it->first);
+        auto value = old_value_ptr->deserialize(it->second);
+        old_value_ptr->change(*value);
     }
 
     return new_object;
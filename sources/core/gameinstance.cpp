@@ -2,22 +2,25 @@
 #include "core/exception.hpp"
 
 core::GameInstance::GameInstance()
-    : _server_side(false),
-      _tick_rate(0),
+    : _tick_rate(0),
+      _server_side(false),
       _base_snapshot(core::Snapshot(0)),
-      _current_snapshot(_base_snapshot)
+      _current_snapshot(_base_snapshot),
+      _history(0)
 {
     // unimplemented
 }
 
 core::GameInstance::GameInstance(core::Snapshot const snapshot,
                                  bool server_side,
-                                 std::uint32_t tick_rate)
-    : _base_snapshot(snapshot),
-      _current_snapshot(_base_snapshot),
+                                 std::uint32_t tick_rate,
+                                 std::size_t history_size,
+                                 std::uint32_t keyframe_interval)
+    : _tick_rate(tick_rate),
       _server_side(server_side),
-      _tick_rate(tick_rate)
-
+      _base_snapshot(snapshot),
+      _current_snapshot(_base_snapshot),
+      _history(history_size, keyframe_interval)
 {
     _initialize();
 }
@@ -29,32 +32,46 @@ std::shared_ptr<core::DeltaSnapshot> core::GameInstance::update_tick()
 
     // fires all the actions in the world state
     _action_status_list.clear();
-    while (!_action_queue.empty()) {
-        auto action_ptr = _action_queue.pop_front();
-        auto status = _play_action(action_ptr, next_snapshot);
-        _action_status_list.push_back(status);
-    }
+    _played_actions.clear();
+    _action_queue.drain([&](std::shared_ptr<GameAction>&& action_ptr) {
+        _action_status_list.push_back(_play_action(action_ptr, next_snapshot));
+        _played_actions.push_back(std::move(action_ptr));
+    });
 
     // updates physics, delta time in seconds
-    next_snapshot.update(_ms_per_tick / 1000.0f);
+    if (_worker_pool != nullptr) {
+        next_snapshot.update(
+            _ms_per_tick / 1000.0f, _current_snapshot, *_worker_pool);
+    }
+    else {
+        next_snapshot.update(_ms_per_tick / 1000.0f);
+    }
 
     // computes delta snapshot
     core::DeltaSnapshot delta_snapshot(_current_snapshot.tick(),
-                                       next_snapshot.tick());
-    delta_snapshot.evaluate(_current_snapshot, next_snapshot);
+                                       next_snapshot.tick(),
+                                       _acquire_delta_arena());
+    if (_worker_pool != nullptr) {
+        delta_snapshot.evaluate(
+            _current_snapshot, next_snapshot, *_worker_pool);
+    }
+    else {
+        delta_snapshot.evaluate(_current_snapshot, next_snapshot);
+    }
 
     auto delta_snapshot_ptr =
         std::make_shared<DeltaSnapshot>(std::move(delta_snapshot));
 
-    _delta_snapshots.push_back(delta_snapshot_ptr);
-    _current_snapshot = next_snapshot;
+    // keeps the previous state as a baseline for late deltas
+    _history.push(std::move(_current_snapshot), delta_snapshot_ptr);
+    _current_snapshot = std::move(next_snapshot);
 
     return delta_snapshot_ptr;
 }
 
-void core::GameInstance::add_action(std::shared_ptr<core::GameAction> action)
+bool core::GameInstance::add_action(std::shared_ptr<core::GameAction> action)
 {
-    _action_queue.push_back(action);
+    return _action_queue.try_push(std::move(action));
 }
 
 core::ActionStatus
@@ -79,6 +96,25 @@ core::GameInstance::_play_action(std::shared_ptr<core::GameAction> action,
     return status;
 }
 
+std::shared_ptr<util::Arena> core::GameInstance::_acquire_delta_arena()
+{
+    // the deltas leave the history in the order they entered it, so the arena
+    // following the last one acquired is usually free
+    for (std::size_t i = 0; i < _delta_arenas.size(); i++) {
+        auto index = (_next_delta_arena + i) % _delta_arenas.size();
+        if (_delta_arenas[index].use_count() == 1) {
+            _delta_arenas[index]->reset();
+            _next_delta_arena = index + 1;
+            return _delta_arenas[index];
+        }
+    }
+
+    // a delta is usually small, the arena grows to the size it needs
+    _delta_arenas.push_back(std::make_shared<util::Arena>(4 * 1024));
+    _next_delta_arena = _delta_arenas.size();
+    return _delta_arenas.back();
+}
+
 void core::GameInstance::_initialize()
 {
     _ms_per_tick = 1000.0f / (float) _tick_rate;
@@ -95,7 +131,26 @@ core::Snapshot const& core::GameInstance::current_snapshot() const
     return _current_snapshot;
 }
 
+core::Snapshot const*
+core::GameInstance::snapshot_at(std::uint32_t tick) const
+{
+    if (tick == _current_snapshot.tick()) {
+        return &_current_snapshot;
+    }
+    return _history.snapshot_at(tick);
+}
+
+core::SnapshotHistory const& core::GameInstance::history() const
+{
+    return _history;
+}
+
 std::vector<std::shared_ptr<core::GameAction>> core::GameInstance::action_list()
 {
-    return _action_queue.to_vector();
+    return _played_actions;
+}
+
+void core::GameInstance::set_worker_pool(util::ThreadPool* pool)
+{
+    _worker_pool = pool;
 }
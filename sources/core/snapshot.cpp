@@ -1,17 +1,63 @@
 #include "core/snapshot.hpp"
 #include "core/exception.hpp"
+#include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <sstream>
 
-core::Snapshot::Snapshot(std::uint32_t tick) : _tick(tick)
+namespace {
+
+/**
+ * @return a new unique snapshot identifier, never 0.
+ */
+std::uint64_t next_snapshot_uid()
+{
+    static std::atomic<std::uint64_t> counter{0};
+    return ++counter;
+}
+
+} // namespace
+
+core::Snapshot::Snapshot(std::uint32_t tick)
+    : _tick(tick), _uid(next_snapshot_uid())
 {
 }
 
-core::Snapshot::Snapshot(const core::Snapshot& other) : _tick(other._tick + 1)
+core::Snapshot::Snapshot(const core::Snapshot& other)
+    : _tick(other._tick + 1),
+      _uid(next_snapshot_uid()),
+      _parent_uid(other._uid),
+      _parent_revision(other._revision)
 {
-    for (auto& obj : other._objects) {
-        this->_objects[obj.first] = obj.second->clone();
+    _objects.reserve(other._objects.size());
+    for (auto const& obj : other._objects) {
+        // both snapshots now share the object, the first one to mutate it
+        // will have to clone it.
+        obj.second.owned = false;
+        _objects.emplace_hint(
+            _objects.end(), obj.first, SnapshotEntry{obj.second.object, false});
+    }
+}
+
+core::Snapshot& core::Snapshot::operator=(const core::Snapshot& other)
+{
+    if (this == &other) {
+        return *this;
+    }
+    _tick = other._tick;
+    _uid = next_snapshot_uid();
+    _parent_uid = other._uid;
+    _revision = 0;
+    _parent_revision = other._revision;
+    _dirty_objects.clear();
+    _objects.clear();
+    _objects.reserve(other._objects.size());
+    for (auto const& obj : other._objects) {
+        obj.second.owned = false;
+        _objects.emplace_hint(
+            _objects.end(), obj.first, SnapshotEntry{obj.second.object, false});
     }
+    return *this;
 }
 
 std::uint32_t core::Snapshot::tick() const
@@ -22,14 +68,15 @@ std::uint32_t core::Snapshot::tick() const
 void core::Snapshot::add_object(std::shared_ptr<GameObject> object)
 {
     auto id = object->id();
-    _objects[id] = object;
+    _objects[id] = SnapshotEntry{std::move(object), true};
+    _mark_dirty(id);
 }
 
 std::shared_ptr<core::GameObject> core::Snapshot::get_object(std::uint32_t id)
 {
     auto it = _objects.find(id);
     if (it != _objects.end()) {
-        return it->second;
+        return _own(it->first, it->second);
     }
     return nullptr;
 }
@@ -38,20 +85,82 @@ core::Snapshot::get_object(std::uint32_t id) const
 {
     auto it = _objects.find(id);
     if (it != _objects.end()) {
-        return it->second;
+        return it->second.object;
     }
     return nullptr;
 }
 
+std::shared_ptr<core::GameObject> const&
+core::Snapshot::_own(std::uint32_t id, core::SnapshotEntry& entry)
+{
+    if (!entry.owned) {
+        // if nobody else holds the object anymore, there is no need to clone.
+        if (entry.object.use_count() > 1) {
+            entry.object = entry.object->clone();
+        }
+        entry.owned = true;
+        // objects owned by the snapshot are either added or already dirty
+        _mark_dirty(id);
+    }
+    return entry.object;
+}
+
+void core::Snapshot::_mark_dirty(std::uint32_t id)
+{
+    _dirty_objects.push_back(id);
+    _revision++;
+}
+
+bool core::Snapshot::_is_parent_of(const core::Snapshot& other) const
+{
+    return other._parent_uid == _uid && other._parent_revision == _revision;
+}
+
 void core::Snapshot::update(float delta_time)
 {
     auto it = _objects.begin();
     while (it != _objects.end()) {
-        it->second->update(delta_time);
+        if (!it->second.object->is_static()) {
+            _own(it->first, it->second)->update(delta_time);
+        }
         it++;
     }
 }
 
+void core::Snapshot::update(float delta_time,
+                            core::Snapshot const& previous,
+                            util::ThreadPool& pool,
+                            std::size_t chunk_size)
+{
+    // takes the ownership of the updated objects first, as it records them
+    // as dirty. The clones themselves are done by the workers.
+    std::vector<std::pair<SnapshotEntry*, bool>> entries;
+    entries.reserve(_objects.size());
+    for (auto& [id, entry] : _objects) {
+        if (entry.object->is_static()) {
+            continue;
+        }
+        bool shared = false;
+        if (!entry.owned) {
+            shared = entry.object.use_count() > 1;
+            entry.owned = true;
+            _mark_dirty(id);
+        }
+        entries.emplace_back(&entry, shared);
+    }
+
+    pool.parallel_for(
+        entries.size(),
+        [&](std::size_t index) {
+            auto& [entry, shared] = entries[index];
+            if (shared) {
+                entry->object = entry->object->clone();
+            }
+            entry->object->update(delta_time, previous);
+        },
+        chunk_size);
+}
+
 core::Snapshot core::Snapshot::apply(core::DeltaSnapshot& delta, float interp)
 {
     if (interp > 1.0f || interp < 0.0f) {
@@ -75,12 +184,15 @@ core::Snapshot core::Snapshot::apply(core::DeltaSnapshot& delta, float interp)
     }
     for (const auto& obj : delta.delta_values()) {
         auto object_id = obj.first;
-        auto object = get_object(object_id);
+        // looks up the object without taking its ownership, interpolate()
+        // already returns a new object.
+        auto it = _objects.find(object_id);
 #ifndef NDEBUG
-        assert(object != nullptr);
+        assert(it != _objects.end());
 #endif
-        auto new_object = object->interpolate(obj.second, interp);
-        next._objects[object_id] = std::move(new_object);
+        auto new_object = it->second.object->interpolate(obj.second, interp);
+        next._objects[object_id] = SnapshotEntry{std::move(new_object), true};
+        next._mark_dirty(object_id);
     }
     return next;
 }
@@ -90,6 +202,7 @@ bool core::Snapshot::delete_object(std::uint32_t id)
     auto it = _objects.find(id);
     if (it != _objects.end()) {
         _objects.erase(it);
+        _mark_dirty(id);
         return true;
     }
     return false;
@@ -109,26 +222,44 @@ core::Snapshot::deserialize(core::serialization::Snapshot const& object)
 core::serialization::Snapshot core::Snapshot::serialize() const
 {
     serialization::Snapshot snapshot;
-    snapshot.set_tick(_tick);
+    serialize_to(&snapshot);
+    return snapshot;
+}
+
+void core::Snapshot::serialize_to(core::serialization::Snapshot* snapshot) const
+{
+    snapshot->set_tick(_tick);
+    snapshot->mutable_objects()->Reserve(_objects.size());
     for (auto const& pair : _objects) {
-        auto serialized_object = pair.second->serialize();
-        // creates a pointer to an allocated space inside the buffer
-        auto* serialized_buffer_ptr = snapshot.add_objects();
-        // sets the element into the allocated space
-        *serialized_buffer_ptr = serialized_object;
+        // the object is written in the space allocated inside the buffer
+        pair.second.object->serialize_to(snapshot->add_objects());
     }
-    return snapshot;
 }
 
 core::DeltaSnapshot::DeltaSnapshot(std::uint32_t prev_snap,
-                                   std::uint32_t next_snap)
-    : _prev_tick(prev_snap), _next_tick(next_snap)
+                                   std::uint32_t next_snap,
+                                   std::pmr::memory_resource* resource)
+    : _prev_tick(prev_snap),
+      _next_tick(next_snap),
+      _resource(resource),
+      _delta_values(resource),
+      _added_objects(resource)
+{
+}
+
+core::DeltaSnapshot::DeltaSnapshot(std::uint32_t prev_snap,
+                                   std::uint32_t next_snap,
+                                   std::shared_ptr<util::Arena> arena)
+    : DeltaSnapshot(prev_snap, next_snap, arena.get())
 {
+    _arena = std::move(arena);
 }
 
 core::DeltaSnapshot::DeltaSnapshot(core::DeltaSnapshot&& delta_snapshot)
     : _prev_tick(delta_snapshot._prev_tick),
       _next_tick(delta_snapshot._next_tick),
+      _arena(std::move(delta_snapshot._arena)),
+      _resource(delta_snapshot._resource),
       _delta_values(std::move(delta_snapshot._delta_values)),
       _deleted_objects(std::move(delta_snapshot._deleted_objects)),
       _added_objects(std::move(delta_snapshot._added_objects))
@@ -138,44 +269,210 @@ core::DeltaSnapshot::DeltaSnapshot(core::DeltaSnapshot&& delta_snapshot)
 }
 
 void core::DeltaSnapshot::evaluate(const core::Snapshot& prev_snap,
-                                   const core::Snapshot& next_snap)
-{
-    // Checks for deleted objects AND delta values between the two snapshots
-    auto it = prev_snap._objects.begin();
-    while (it != prev_snap._objects.end()) {
-        std::uint32_t object_id = it->first;
-        auto prev_object = prev_snap.get_object(object_id);
-        auto next_object = next_snap.get_object(object_id);
-#ifndef NDEBUG
-        assert(prev_object != nullptr);
-#endif
-        if (next_object == nullptr) {
-            // object has been deleted in the new snapshot so we added it in the
-            // deleted objects
-            _deleted_objects.push_back(object_id);
+                                   const core::Snapshot& next_snap,
+                                   bool verify)
+{
+    if (!verify && prev_snap._is_parent_of(next_snap)) {
+        _evaluate_dirty(prev_snap, next_snap, nullptr);
+    }
+    else {
+        _evaluate_all(prev_snap, next_snap, nullptr);
+    }
+}
+
+void core::DeltaSnapshot::evaluate(const core::Snapshot& prev_snap,
+                                   const core::Snapshot& next_snap,
+                                   util::ThreadPool& pool,
+                                   bool verify)
+{
+    if (!verify && prev_snap._is_parent_of(next_snap)) {
+        _evaluate_dirty(prev_snap, next_snap, &pool);
+    }
+    else {
+        _evaluate_all(prev_snap, next_snap, &pool);
+    }
+}
+
+void core::DeltaSnapshot::_evaluate_all(const core::Snapshot& prev_snap,
+                                        const core::Snapshot& next_snap,
+                                        util::ThreadPool* pool)
+{
+    if (pool == nullptr) {
+        auto ranges = _make_ranges(1);
+        _evaluate_range(prev_snap, next_snap, 0, std::nullopt, ranges.front());
+        _merge_ranges(ranges);
+        return;
+    }
+
+    // splits the ids on every parallel_chunk_size-th object of the largest
+    // snapshot, the first range starts at id 0 and the last one is unbounded
+    auto const& objects = prev_snap._objects.size() > next_snap._objects.size()
+                              ? prev_snap._objects
+                              : next_snap._objects;
+    std::pmr::vector<std::uint32_t> bounds(1, 0, _resource);
+    for (auto position = parallel_chunk_size; position < objects.size();
+         position += parallel_chunk_size) {
+        bounds.push_back((objects.begin() + position)->first);
+    }
+
+    auto ranges = _make_ranges(bounds.size());
+    pool->parallel_for(ranges.size(), [&](std::size_t index) {
+        std::optional<std::uint32_t> last_id;
+        if (index + 1 < bounds.size()) {
+            last_id = bounds[index + 1];
+        }
+        _evaluate_range(
+            prev_snap, next_snap, bounds[index], last_id, ranges[index]);
+    });
+    _merge_ranges(ranges);
+}
+
+void core::DeltaSnapshot::_evaluate_range(const core::Snapshot& prev_snap,
+                                          const core::Snapshot& next_snap,
+                                          std::uint32_t first_id,
+                                          std::optional<std::uint32_t> last_id,
+                                          DeltaRange& range)
+{
+    auto const& prev_objects = prev_snap._objects;
+    auto const& next_objects = next_snap._objects;
+    auto prev_it = prev_objects.lower_bound(first_id);
+    auto next_it = next_objects.lower_bound(first_id);
+    auto prev_end = last_id ? prev_objects.lower_bound(*last_id)
+                            : prev_objects.end();
+    auto next_end = last_id ? next_objects.lower_bound(*last_id)
+                            : next_objects.end();
+
+    // both maps are sorted by id, an id missing in one of them is an added
+    // or deleted object
+    while (prev_it != prev_end || next_it != next_end) {
+        if (next_it == next_end
+            || (prev_it != prev_end && prev_it->first < next_it->first)) {
+            _compare_object(
+                prev_it->first, &prev_it->second.object, nullptr, true, range);
+            prev_it++;
         }
-        else if (prev_object->checksum() != next_object->checksum()) {
-            // object still exists so we keep it in delta vlaue if it has
-            // changed (different checksum)
-            auto differences = prev_object->compare(next_object.get());
-            _delta_values[prev_object->id()] = differences;
+        else if (prev_it == prev_end || next_it->first < prev_it->first) {
+            _compare_object(
+                next_it->first, nullptr, &next_it->second.object, true, range);
+            next_it++;
+        }
+        else {
+            _compare_object(prev_it->first,
+                            &prev_it->second.object,
+                            &next_it->second.object,
+                            true,
+                            range);
+            prev_it++;
+            next_it++;
         }
-        it++;
     }
-    // Checks the added objects between the two snapshots
-    it = next_snap._objects.begin();
-    while (it != next_snap._objects.end()) {
-        std::uint32_t object_id = it->first;
-        auto next_object = next_snap.get_object(object_id);
-        auto prev_object = prev_snap.get_object(object_id);
-#ifndef NDEBUG
-        assert(next_object != nullptr);
-#endif
-        if (prev_object == nullptr) {
-            _added_objects[object_id] =
-                std::const_pointer_cast<GameObject>(next_object);
+}
+
+void core::DeltaSnapshot::_compare_object(
+    std::uint32_t object_id,
+    std::shared_ptr<GameObject> const* prev_object,
+    std::shared_ptr<GameObject> const* next_object,
+    bool checksum,
+    DeltaRange& range)
+{
+    if (prev_object == nullptr && next_object != nullptr) {
+        range.added_objects.emplace_back(object_id, *next_object);
+    }
+    else if (prev_object != nullptr && next_object == nullptr) {
+        // object has been deleted in the new snapshot
+        range.deleted_objects.push_back(object_id);
+    }
+    else if (prev_object == nullptr || *prev_object == *next_object) {
+        // object is still shared between the two snapshots, it cannot have
+        // changed.
+    }
+    else if (!checksum
+             || (*prev_object)->checksum() != (*next_object)->checksum()) {
+        // object still exists so we keep it in delta values if it has changed
+        auto differences = (*prev_object)->compare(
+            next_object->get(), range.delta_values.get_allocator().resource());
+        // a dirty object may have been written with its own values
+        if (!differences.empty()) {
+            range.delta_values.emplace_back(object_id, std::move(differences));
+        }
+    }
+}
+
+void core::DeltaSnapshot::_evaluate_dirty(const core::Snapshot& prev_snap,
+                                          const core::Snapshot& next_snap,
+                                          util::ThreadPool* pool)
+{
+    // the dirty objects are the only ones that might have changed, so the cost
+    // only depends on the number of changes and not on the world size.
+    std::pmr::vector<std::uint32_t> dirty_objects(
+        next_snap._dirty_objects.begin(),
+        next_snap._dirty_objects.end(),
+        _resource);
+    std::sort(dirty_objects.begin(), dirty_objects.end());
+    dirty_objects.erase(std::unique(dirty_objects.begin(), dirty_objects.end()),
+                        dirty_objects.end());
+
+    auto find_object = [](core::Snapshot const& snapshot, std::uint32_t id) {
+        auto it = snapshot._objects.find(id);
+        return it != snapshot._objects.end() ? &it->second.object : nullptr;
+    };
+    // no checksum here, the unchanged values of the dirty objects are
+    // skipped by compare()
+    auto compare_chunk = [&](std::size_t chunk, DeltaRange& range) {
+        auto end = std::min(dirty_objects.size(),
+                            (chunk + 1) * parallel_chunk_size);
+        for (auto i = chunk * parallel_chunk_size; i < end; i++) {
+            auto object_id = dirty_objects[i];
+            _compare_object(object_id,
+                            find_object(prev_snap, object_id),
+                            find_object(next_snap, object_id),
+                            false,
+                            range);
+        }
+    };
+
+    auto chunk_count = (dirty_objects.size() + parallel_chunk_size - 1)
+                       / parallel_chunk_size;
+    auto ranges = _make_ranges(chunk_count);
+    if (pool == nullptr) {
+        for (std::size_t chunk = 0; chunk < chunk_count; chunk++) {
+            compare_chunk(chunk, ranges[chunk]);
+        }
+    }
+    else {
+        pool->parallel_for(chunk_count, [&](std::size_t chunk) {
+            compare_chunk(chunk, ranges[chunk]);
+        });
+    }
+    _merge_ranges(ranges);
+}
+
+std::pmr::vector<core::DeltaSnapshot::DeltaRange>
+core::DeltaSnapshot::_make_ranges(std::size_t count) const
+{
+    std::pmr::vector<DeltaRange> ranges(_resource);
+    ranges.reserve(count);
+    for (std::size_t i = 0; i < count; i++) {
+        ranges.emplace_back(_resource);
+    }
+    return ranges;
+}
+
+void core::DeltaSnapshot::_merge_ranges(std::pmr::vector<DeltaRange>& ranges)
+{
+    // the ranges are sorted, the values are appended at the end of the maps
+    for (auto& range : ranges) {
+        for (auto& pair : range.delta_values) {
+            _delta_values.emplace_hint(
+                _delta_values.end(), pair.first, std::move(pair.second));
+        }
+        _deleted_objects.insert(_deleted_objects.end(),
+                                range.deleted_objects.begin(),
+                                range.deleted_objects.end());
+        for (auto& pair : range.added_objects) {
+            _added_objects.emplace_hint(
+                _added_objects.end(), pair.first, std::move(pair.second));
         }
-        it++;
     }
 }
 
@@ -202,22 +499,36 @@ core::DeltaSnapshot core::DeltaSnapshot::deserialize(
     auto const& object_values_dict = object.delta_objects();
     // iterates for each object in the diffmap
     for (auto const& pair : object_values_dict) {
-        diffset_t value_differences;
         auto object_id = pair.first;
         // get the object reference, used to deserialize game values
         auto object_reference = reference_snapshot.get_object(object_id);
-        // iterates for each object game value
+        diffset_t value_differences(object_reference->schema());
+        auto const& packed_values = pair.second.packed_values();
+        ByteReader reader(packed_values.data(), packed_values.size());
+        while (reader.remaining() > 0) {
+            auto field = reader.read<field_id_t>();
+            if (object_reference->schema() == nullptr
+                || field >= object_reference->schema()->size()) {
+                throw core::HarakaException("Invalid delta value field.");
+            }
+            // the reference value gives the type to read
+            ValueBox value(*object_reference->get_value(field));
+            value->read(reader);
+            value_differences.insert(field, std::move(value));
+        }
+        // delta values serialized by name
         for (auto const& value_pair : pair.second.values()) {
+            // the wire format still uses the value names
+            auto field = object_reference->schema()->index(value_pair.first);
             // gets the object reference value
-            auto* object_reference_value =
-                object_reference->get_value(value_pair.first);
+            auto* object_reference_value = object_reference->get_value(field);
             // deserialize from our object reference value
             auto deserialized_game_value =
                 object_reference_value->deserialize(value_pair.second);
             // insert the deserialized game value in the diffset with the value
-            // name.
-            value_differences.insert(
-                {value_pair.first, deserialized_game_value});
+            // index.
+            value_differences.insert(field,
+                                     std::move(deserialized_game_value));
         }
         delta_snapshot._delta_values.insert({object_id, value_differences});
     }
@@ -241,31 +552,246 @@ core::DeltaSnapshot core::DeltaSnapshot::deserialize(
 core::serialization::DeltaSnapshot core::DeltaSnapshot::serialize() const
 {
     serialization::DeltaSnapshot delta_snapshot;
-    delta_snapshot.set_prev_tick(_prev_tick);
-    delta_snapshot.set_next_tick(_next_tick);
+    serialize_to(&delta_snapshot);
+    return delta_snapshot;
+}
+
+core::serialization::DeltaSnapshot
+core::DeltaSnapshot::serialize(util::ThreadPool& pool) const
+{
+    serialization::DeltaSnapshot delta_snapshot;
+    serialize_to(&delta_snapshot, pool);
+    return delta_snapshot;
+}
+
+void core::DeltaSnapshot::serialize_to(
+    core::serialization::DeltaSnapshot* delta_snapshot) const
+{
+    delta_snapshot->set_prev_tick(_prev_tick);
+    delta_snapshot->set_next_tick(_next_tick);
 
     // serializes delta differences
-    auto& delta_objects = *delta_snapshot.mutable_delta_objects();
+    auto& delta_objects = *delta_snapshot->mutable_delta_objects();
     for (auto const& delta_value_pair : _delta_values) {
-        serialization::ValueMap value_map;
-        auto* serialized_values = value_map.mutable_values();
-        for (auto const& values : delta_value_pair.second) {
-            // add to serialized_values
-            serialized_values->insert(
-                {values.first, values.second->serialize()});
-        }
-        delta_objects[delta_value_pair.first] = value_map;
+        _serialize_differences(delta_value_pair.second,
+                               &delta_objects[delta_value_pair.first]);
     }
 
     // serializes added objects
+    delta_snapshot->mutable_added_objects()->Reserve(_added_objects.size());
     for (auto const& object_pair : _added_objects) {
-        auto* obj_ptr = delta_snapshot.add_added_objects();
-        *obj_ptr = object_pair.second->serialize();
+        object_pair.second->serialize_to(delta_snapshot->add_added_objects());
     }
 
     // serializes deleted objects
+    delta_snapshot->mutable_deleted_objects()->Reserve(_deleted_objects.size());
+    for (auto object_id : _deleted_objects) {
+        delta_snapshot->add_deleted_objects(object_id);
+    }
+}
+
+void core::DeltaSnapshot::serialize_to(
+    core::serialization::DeltaSnapshot* delta_snapshot,
+    util::ThreadPool& pool) const
+{
+    delta_snapshot->set_prev_tick(_prev_tick);
+    delta_snapshot->set_next_tick(_next_tick);
+
+    // the protobuf containers can't be filled concurrently, the sub-messages
+    // are added first then written in place by the workers
+    std::vector<serialization::ValueMap*> value_maps;
+    value_maps.reserve(_delta_values.size());
+    auto& delta_objects = *delta_snapshot->mutable_delta_objects();
+    for (auto const& delta_value_pair : _delta_values) {
+        value_maps.push_back(&delta_objects[delta_value_pair.first]);
+    }
+
+    std::vector<serialization::GameObject*> objects;
+    objects.reserve(_added_objects.size());
+    delta_snapshot->mutable_added_objects()->Reserve(_added_objects.size());
+    for (std::size_t i = 0; i < _added_objects.size(); i++) {
+        objects.push_back(delta_snapshot->add_added_objects());
+    }
+
+    auto delta_values = _delta_values.begin();
+    auto added_objects = _added_objects.begin();
+    pool.parallel_for(
+        value_maps.size() + objects.size(),
+        [&](std::size_t index) {
+            if (index < value_maps.size()) {
+                _serialize_differences(delta_values[index].second,
+                                       value_maps[index]);
+            }
+            else {
+                index -= value_maps.size();
+                added_objects[index].second->serialize_to(objects[index]);
+            }
+        },
+        parallel_chunk_size);
+
+    delta_snapshot->mutable_deleted_objects()->Reserve(_deleted_objects.size());
     for (auto object_id : _deleted_objects) {
-        delta_snapshot.add_deleted_objects(object_id);
+        delta_snapshot->add_deleted_objects(object_id);
+    }
+}
+
+void core::DeltaSnapshot::_serialize_differences(
+    core::diffset_t const& differences,
+    core::serialization::ValueMap* value_map)
+{
+    std::size_t packed_size = 0;
+    for (auto const& values : differences) {
+        packed_size += sizeof(field_id_t) + values.second->byte_size();
+    }
+    auto& packed_values = *value_map->mutable_packed_values();
+    packed_values.resize(packed_size);
+    ByteWriter writer(packed_values.data(), packed_values.size());
+    for (auto const& values : differences) {
+        writer.write(values.first);
+        values.second->write(writer);
+    }
+}
+
+std::string
+core::DeltaSnapshot::serialize_packed(core::Snapshot const& next_snapshot) const
+{
+    BitWriter writer;
+    writer.write_varint(_prev_tick);
+    writer.write_varint(_next_tick - _prev_tick);
+
+    // objects with only zero delta values are skipped
+    std::vector<diffmap_t::const_iterator> changed_objects;
+    for (auto it = _delta_values.begin(); it != _delta_values.end(); it++) {
+        auto const& differences = it->second;
+        if (std::any_of(differences.begin(),
+                        differences.end(),
+                        [](auto const& pair) {
+                            return !pair.second->is_zero();
+                        })) {
+            changed_objects.push_back(it);
+        }
+    }
+
+    writer.write_varint(changed_objects.size());
+    std::uint32_t previous_id = 0;
+    for (auto it : changed_objects) {
+        writer.write_varint(it->first - previous_id);
+        previous_id = it->first;
+
+        auto const& differences = it->second;
+        auto const* schema = differences.schema();
+        // bitmask of the sent fields, in schema order
+        auto diff_it = differences.begin();
+        for (field_id_t field = 0; field < schema->size(); field++) {
+            bool sent = diff_it != differences.end()
+                        && diff_it->first == field
+                        && !diff_it->second->is_zero();
+            writer.write_bool(sent);
+            if (diff_it != differences.end() && diff_it->first == field) {
+                diff_it++;
+            }
+        }
+        std::shared_ptr<const GameObject> next_object;
+        for (auto const& pair : differences) {
+            if (pair.second->is_zero()) {
+                continue;
+            }
+            auto const* quantization = schema->quantization(pair.first);
+            if (quantization == nullptr) {
+                pair.second->pack(writer, nullptr);
+                continue;
+            }
+            if (next_object == nullptr) {
+                next_object = next_snapshot.get_object(it->first);
+                if (next_object == nullptr) {
+                    throw core::UnknownIDException("Unknown delta object.",
+                                                   it->first);
+                }
+            }
+            next_object->get_value(pair.first)->pack(writer, quantization);
+        }
+    }
+
+    writer.write_varint(_deleted_objects.size());
+    previous_id = 0;
+    for (auto object_id : _deleted_objects) {
+        writer.write_signed_varint(static_cast<std::int64_t>(object_id)
+                                   - previous_id);
+        previous_id = object_id;
+    }
+
+    writer.write_varint(_added_objects.size());
+    previous_id = 0;
+    for (auto const& object_pair : _added_objects) {
+        writer.write_varint(object_pair.first - previous_id);
+        previous_id = object_pair.first;
+        object_pair.second->pack(writer);
+    }
+
+    return writer.finish();
+}
+
+core::DeltaSnapshot
+core::DeltaSnapshot::deserialize_packed(
+    std::string const& bytes, core::Snapshot const& reference_snapshot)
+{
+    BitReader reader(bytes.data(), bytes.size());
+    auto prev_tick = static_cast<std::uint32_t>(reader.read_varint());
+    auto next_tick =
+        prev_tick + static_cast<std::uint32_t>(reader.read_varint());
+    core::DeltaSnapshot delta_snapshot(prev_tick, next_tick);
+
+    auto changed_count = reader.read_varint();
+    std::uint32_t object_id = 0;
+    std::vector<field_id_t> fields;
+    for (std::uint64_t i = 0; i < changed_count; i++) {
+        object_id += static_cast<std::uint32_t>(reader.read_varint());
+        auto object_reference = reference_snapshot.get_object(object_id);
+        if (object_reference == nullptr
+            || object_reference->schema() == nullptr) {
+            throw core::UnknownIDException("Unknown delta object.", object_id);
+        }
+        auto const* schema = object_reference->schema();
+
+        fields.clear();
+        for (field_id_t field = 0; field < schema->size(); field++) {
+            if (reader.read_bool()) {
+                fields.push_back(field);
+            }
+        }
+
+        diffset_t value_differences(schema);
+        value_differences.reserve(fields.size());
+        for (auto field : fields) {
+            // the reference value gives the type to read
+            auto const* reference_value = object_reference->get_value(field);
+            auto const* quantization = schema->quantization(field);
+            ValueBox value(*reference_value);
+            value->unpack(reader, quantization);
+            if (quantization != nullptr) {
+                // absolute value, the delta is taken from the reference
+                value = reference_value->get_delta(value.get());
+            }
+            value_differences.insert(field, std::move(value));
+        }
+        delta_snapshot._delta_values.emplace(object_id,
+                                             std::move(value_differences));
+    }
+
+    auto deleted_count = reader.read_varint();
+    object_id = 0;
+    for (std::uint64_t i = 0; i < deleted_count; i++) {
+        object_id += static_cast<std::uint32_t>(reader.read_signed_varint());
+        delta_snapshot._deleted_objects.push_back(object_id);
+    }
+
+    auto added_count = reader.read_varint();
+    object_id = 0;
+    for (std::uint64_t i = 0; i < added_count; i++) {
+        object_id += static_cast<std::uint32_t>(reader.read_varint());
+        std::shared_ptr<GameObject> object =
+            core::GameObject::unpack(reader, object_id);
+        delta_snapshot._added_objects.emplace(object_id, std::move(object));
     }
 
     return delta_snapshot;
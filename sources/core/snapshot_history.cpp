@@ -0,0 +1,113 @@
+#include "core/snapshot_history.hpp"
+#include <algorithm>
+#include <cassert>
+
+core::SnapshotHistory::SnapshotHistory(std::size_t capacity,
+                                       std::uint32_t keyframe_interval,
+                                       std::size_t keyframe_capacity)
+    : _slots(capacity),
+      _keyframes(keyframe_interval > 0 ? keyframe_capacity : 0),
+      _keyframe_interval(keyframe_interval)
+{
+}
+
+void core::SnapshotHistory::push(core::Snapshot&& snapshot,
+                                 std::shared_ptr<DeltaSnapshot> delta)
+{
+#ifndef NDEBUG
+    assert(empty() || snapshot.tick() > _latest_tick);
+#endif
+    auto tick = snapshot.tick();
+
+    if (!_keyframes.empty() && tick % _keyframe_interval == 0) {
+        auto& keyframe =
+            _keyframes[(tick / _keyframe_interval) % _keyframes.size()];
+        // the copy assignment keeps the tick and shares the objects
+        keyframe.emplace(tick);
+        *keyframe = snapshot;
+    }
+
+    if (_slots.empty()) {
+        return;
+    }
+    auto& slot = _slots[tick % _slots.size()];
+    slot.snapshot.emplace(std::move(snapshot));
+    slot.delta = std::move(delta);
+
+    // skipped ticks leave stale slots in the window, lookups check the tick
+    std::size_t skipped = empty() ? 0 : tick - _latest_tick - 1;
+    _size = std::min(_size + skipped + 1, _slots.size());
+    _latest_tick = tick;
+}
+
+core::Snapshot const*
+core::SnapshotHistory::snapshot_at(std::uint32_t tick) const
+{
+    if (!_slots.empty()) {
+        auto const& slot = _slots[tick % _slots.size()];
+        if (slot.snapshot && slot.snapshot->tick() == tick) {
+            return &*slot.snapshot;
+        }
+    }
+    if (!_keyframes.empty() && tick % _keyframe_interval == 0) {
+        auto const& keyframe =
+            _keyframes[(tick / _keyframe_interval) % _keyframes.size()];
+        if (keyframe && keyframe->tick() == tick) {
+            return &*keyframe;
+        }
+    }
+    return nullptr;
+}
+
+std::shared_ptr<core::DeltaSnapshot>
+core::SnapshotHistory::delta_from(std::uint32_t tick) const
+{
+    if (_slots.empty()) {
+        return nullptr;
+    }
+    auto const& slot = _slots[tick % _slots.size()];
+    if (slot.snapshot && slot.snapshot->tick() == tick) {
+        return slot.delta;
+    }
+    return nullptr;
+}
+
+core::Snapshot const*
+core::SnapshotHistory::keyframe_before(std::uint32_t tick) const
+{
+    if (_keyframes.empty()) {
+        return nullptr;
+    }
+    auto keyframe_tick = tick - tick % _keyframe_interval;
+    auto const& keyframe =
+        _keyframes[(keyframe_tick / _keyframe_interval) % _keyframes.size()];
+    if (keyframe && keyframe->tick() == keyframe_tick) {
+        return &*keyframe;
+    }
+    return nullptr;
+}
+
+std::size_t core::SnapshotHistory::size() const
+{
+    return _size;
+}
+
+std::size_t core::SnapshotHistory::capacity() const
+{
+    return _slots.size();
+}
+
+bool core::SnapshotHistory::empty() const
+{
+    return _size == 0;
+}
+
+std::uint32_t core::SnapshotHistory::oldest_tick() const
+{
+    return _latest_tick - static_cast<std::uint32_t>(_size) + 1;
+}
+
+std::uint32_t core::SnapshotHistory::latest_tick() const
+{
+    return _latest_tick;
+}
@@ -0,0 +1,142 @@
+#include "core/value_schema.hpp"
+#include "core/exception.hpp"
+#include <algorithm>
+#include <cassert>
+#include <stdexcept>
+
+core::ValueSchema::ValueSchema(std::initializer_list<Field> fields)
+    : _fields(fields)
+{
+    for (auto const& field : _fields) {
+        // the steps are packed in a signed 64 bits integer
+        if (field.quantized
+            && (field.quantization.bits < 1 || field.quantization.bits > 63
+                || !(field.quantization.precision > 0.0f))) {
+            throw InvalidQuantizationException("Invalid field quantization.",
+                                               field.name);
+        }
+    }
+}
+
+core::field_id_t core::ValueSchema::size() const
+{
+    return static_cast<field_id_t>(_fields.size());
+}
+
+std::string const& core::ValueSchema::name(core::field_id_t field) const
+{
+    return _fields.at(field).name;
+}
+
+core::field_id_t core::ValueSchema::index(std::string const& name) const
+{
+    auto it = std::find_if(_fields.begin(),
+                           _fields.end(),
+                           [&name](Field const& field) {
+                               return field.name == name;
+                           });
+    if (it == _fields.end()) {
+        throw UnknownFieldException("Unknown field name.", name);
+    }
+    return static_cast<field_id_t>(it - _fields.begin());
+}
+
+core::Quantization const*
+core::ValueSchema::quantization(core::field_id_t field) const
+{
+    auto const& declaration = _fields.at(field);
+    return declaration.quantized ? &declaration.quantization : nullptr;
+}
+
+void core::ValueTable::bind(core::ValueSchema const& schema,
+                            std::initializer_list<GameValue*> values)
+{
+#ifndef NDEBUG
+    assert(values.size() == schema.size());
+#endif
+    _schema = &schema;
+    _values.assign(values);
+}
+
+core::GameValue* core::ValueTable::at(std::string const& name) const
+{
+    if (_schema == nullptr) {
+        throw UnknownFieldException("Values are not bound.", name);
+    }
+    return _values[_schema->index(name)];
+}
+
+core::DiffSet::DiffSet(core::ValueSchema const* schema,
+                       allocator_type allocator)
+    : _schema(schema), _values(allocator)
+{
+}
+
+core::DiffSet::DiffSet(allocator_type allocator)
+    : _schema(nullptr), _values(allocator)
+{
+}
+
+core::DiffSet::DiffSet(core::DiffSet const& other, allocator_type allocator)
+    : _schema(other._schema), _values(other._values, allocator)
+{
+}
+
+core::DiffSet::DiffSet(core::DiffSet&& other, allocator_type allocator)
+    : _schema(other._schema), _values(std::move(other._values), allocator)
+{
+}
+
+void core::DiffSet::insert(core::field_id_t field, core::value_t value)
+{
+    if (_values.empty() || _values.back().first < field) {
+        _values.emplace_back(field, std::move(value));
+        return;
+    }
+    auto it = std::lower_bound(
+        _values.begin(),
+        _values.end(),
+        field,
+        [](value_type const& pair, field_id_t id) { return pair.first < id; });
+    if (it != _values.end() && it->first == field) {
+        it->second = std::move(value);
+    }
+    else {
+        _values.emplace(it, field, std::move(value));
+    }
+}
+
+core::DiffSet::const_iterator core::DiffSet::_find(core::field_id_t field) const
+{
+    auto it = std::lower_bound(
+        _values.begin(),
+        _values.end(),
+        field,
+        [](value_type const& pair, field_id_t id) { return pair.first < id; });
+    if (it != _values.end() && it->first == field) {
+        return it;
+    }
+    return _values.end();
+}
+
+core::value_t const& core::DiffSet::at(core::field_id_t field) const
+{
+    auto it = _find(field);
+    if (it == _values.end()) {
+        throw std::out_of_range("Field not in the diffset.");
+    }
+    return it->second;
+}
+
+core::value_t const& core::DiffSet::at(std::string const& name) const
+{
+    if (_schema == nullptr) {
+        throw std::out_of_range("Diffset has no schema.");
+    }
+    return at(_schema->index(name));
+}
+
+std::size_t core::DiffSet::count(core::field_id_t field) const
+{
+    return _find(field) == _values.end() ? 0 : 1;
+}
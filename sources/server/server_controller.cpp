@@ -1,20 +1,44 @@
 #include "server/server_controller.hpp"
+#include <algorithm>
+#include <map>
+#include <optional>
 
 // -----------------------------------------------------------------------------
 // Server controller definitions
 // -----------------------------------------------------------------------------
 
 server::ServerController::ServerController(std::uint32_t tick_rate,
-                                           std::uint16_t port)
-    : net::ServerInterface<HarakaPackets>(port),
+                                           std::uint16_t port,
+                                           std::size_t io_threads,
+                                           bool udp,
+                                           std::size_t instance_count,
+                                           std::size_t worker_threads)
+    : net::ServerInterface<HarakaPackets>(port, io_threads, udp),
+      _workers(worker_threads),
+      _scheduler(tick_rate),
       _tick_rate(tick_rate),
-      _ms_per_tick(1000.0f / ((float) _tick_rate)),
-      _instance(core::Snapshot(0), true, tick_rate)
+      _ms_per_tick(1000.0f / ((float) _tick_rate))
 {
+    // a lost delta is superseded by the next one, computed from the last
+    // acknowledged snapshot
+    set_udp_channel(DELTA_SNAPSHOT_RESULT,
+                    net::Channel::UNRELIABLE_SEQUENCED);
+
+    _reset_message_arena();
+
+    for (std::size_t i = 0; i < instance_count; i++) {
+        create_instance();
+    }
+}
+
+server::ServerController::~ServerController()
+{
+    // the io threads must not call the handlers of a destroyed controller
+    stop();
 }
 
 bool server::ServerController::on_client_connect(
-    std::shared_ptr<net::TCPSession<HarakaPackets>> client)
+    std::shared_ptr<net::Session<HarakaPackets>> client)
 {
     // the server created a TCPSession but here we don't create a session log
     // until the client hasn't given credentials
@@ -29,68 +53,125 @@ bool server::ServerController::on_client_connect(
 }
 
 void server::ServerController::on_client_disconnect(
-    std::shared_ptr<net::TCPSession<HarakaPackets>> client)
+    std::shared_ptr<net::Session<HarakaPackets>> client)
 {
     // checks if there is a session info attached to this client session
-    auto it = std::find_if(
-        _session_info.begin(), _session_info.end(), [&](auto& val) {
-            return std::const_pointer_cast<
-                       std::shared_ptr<net::TCPSession<HarakaPackets>>>(
-                       val.session())
-                       .get()
-                   == client.get();
-        });
-    // disconnect this session if found
-    if (it != _session_info.end()) {
-        it->disconnect();
+    auto* session_info = _find_session_info(client);
+    // disconnect this session if found, its info is erased after the tick
+    if (session_info != nullptr) {
+        session_info->disconnect();
     }
 }
 
 void server::ServerController::on_message(
-    std::shared_ptr<net::TCPSession<HarakaPackets>> client,
+    std::shared_ptr<net::Session<HarakaPackets>> client,
     net::Packet<server::HarakaPackets> packet)
 {
     // first check if there is a session info attached to this client
-    auto it = std::find_if(
-        _session_info.begin(), _session_info.end(), [&](const auto& val) {
-          return std::const_pointer_cast<
-              std::shared_ptr<net::TCPSession<HarakaPackets>>>(
-              val.session())
-                     .get()
-                 == client.get();
-        });
+    auto* session_info = _find_session_info(client);
 
     // if there is no session found and that is a connection packet
-    if (it == _session_info.end()
+    if (session_info == nullptr
         && packet.header.id == HarakaPackets::CONNECTION) {
         _parse_connection_result(client, packet);
     }
     // if there is a session and it is logged
-    else if (it->logged()) {
+    else if (session_info != nullptr && session_info->logged()) {
         switch (packet.header.id) {
         case DISCONNECTION:
             break;
         case FULL_SNAPSHOT:
+            if (auto* shard = _find_shard(*session_info)) {
+                // shared with the resyncing clients until the next tick
+                if (!shard->full_snapshot) {
+                    shard->full_snapshot =
+                        _encode_full_snapshot(*shard->instance);
+                }
+                message_client(client, *shard->full_snapshot);
+            }
             break;
         case ACTION:
             break;
+        case SNAPSHOT_ACK:
+            if (auto* shard = _find_shard(*session_info)) {
+                _parse_snapshot_ack(*session_info, *shard->instance, packet);
+            }
+            break;
+        default:
+            break;
         }
     }
 }
 
 void server::ServerController::update_tick()
 {
-    // makes a copy of all the instance actions
-    auto actions = _instance.action_list();
+    // the instances are independent, their ticks run in parallel
+    _workers.parallel_for(_shards.size(), [this](std::size_t index) {
+        auto& shard = *(_shards.begin() + index);
+
+        // evaluated delta snapshot
+        shard.delta = shard.instance->update_tick();
 
-    // TODO problem: an action might be added here by another thread. FIX
+        // the actions played during this tick and their results
+        shard.actions = shard.instance->action_list();
+        shard.status_list = shard.instance->action_status_list();
 
-    // evaluated delta snapshot
-    auto delta = _instance.update_tick();
-    auto action_result = _instance.action_status_list();
+        shard.updates.clear();
+        shard.full_snapshot.reset();
+    });
 
     // sends to clients
-    _send_delta_update(*delta, action_result, actions);
+    _send_delta_updates();
+    _tick_arena.reset();
+    _reset_message_arena();
+
+    _erase_disconnected_session_info();
+}
+
+util::slot_key_t server::ServerController::create_instance()
+{
+    Shard shard;
+    shard.instance = std::make_unique<core::GameInstance>(
+        core::Snapshot(0), true, _tick_rate);
+    // the objects of the instance are updated by the workers as well
+    shard.instance->set_worker_pool(&_workers);
+    return _shards.insert(std::move(shard));
+}
+
+bool server::ServerController::remove_instance(util::slot_key_t key)
+{
+    return _shards.erase(key);
+}
+
+core::GameInstance* server::ServerController::instance(util::slot_key_t key)
+{
+    auto* shard = _shards.get(key);
+    return shard ? shard->instance.get() : nullptr;
+}
+
+std::size_t server::ServerController::instance_count() const
+{
+    return _shards.size();
+}
+
+std::size_t
+server::ServerController::session_count(util::slot_key_t key) const
+{
+    auto const* shard = _shards.get(key);
+    return shard ? shard->session_count : 0;
+}
+
+void server::ServerController::run()
+{
+    _scheduler.run([this](util::TickScheduler::clock_t::time_point deadline) {
+        update_until(deadline - _scheduler.period() / 2);
+        update_tick();
+    });
+}
+
+void server::ServerController::stop_running()
+{
+    _scheduler.stop();
 }
 
 net::Packet<server::HarakaPackets>
@@ -109,38 +190,203 @@ server::ServerController::_encode_packet(google::protobuf::Message* msg,
     return packet;
 }
 
-void server::ServerController::_send_delta_update(
+void server::ServerController::_send_delta_updates()
+{
+    for (auto& session_info : _session_info) {
+        if (!session_info.logged()) {
+            continue;
+        }
+
+        auto* shard = _find_shard(session_info);
+        if (shard == nullptr) {
+            // its instance has been removed
+            shard = _route_session(session_info);
+        }
+        if (shard == nullptr || !shard->delta) {
+            continue;
+        }
+
+        auto const& instance = *shard->instance;
+        auto const& current_snapshot = instance.current_snapshot();
+        auto const& delta = *shard->delta;
+        auto const& status_list = shard->status_list;
+        auto const& actions = shard->actions;
+        auto& updates = shard->updates;
+
+        // the clients which never acknowledged a snapshot get the delta from
+        // the previous tick, shared with the clients having acknowledged it
+        auto baseline_tick = session_info.has_baseline()
+                                 ? session_info.acked_tick()
+                                 : delta.prev_tick();
+        auto update = updates.find(baseline_tick);
+        if (update == updates.end() && baseline_tick == delta.prev_tick()) {
+            update =
+                updates
+                    .emplace(baseline_tick,
+                             _encode_delta_update(delta, status_list, actions))
+                    .first;
+        }
+        else if (update == updates.end()) {
+            auto const* baseline = instance.snapshot_at(baseline_tick);
+            if (baseline != nullptr) {
+                // only needed to encode the update
+                core::DeltaSnapshot baseline_delta(baseline_tick,
+                                                   current_snapshot.tick(),
+                                                   &_tick_arena);
+                baseline_delta.evaluate(*baseline, current_snapshot);
+                update = updates
+                             .emplace(baseline_tick,
+                                      _encode_delta_update(
+                                          baseline_delta, status_list, actions))
+                             .first;
+            }
+        }
+
+        if (update != updates.end()) {
+            message_client(session_info.session(), update->second);
+        }
+        else {
+            // baseline too old for the history, the client resyncs
+            if (!shard->full_snapshot) {
+                shard->full_snapshot = _encode_full_snapshot(instance);
+            }
+            message_client(session_info.session(), *shard->full_snapshot);
+        }
+    }
+}
+
+net::Packet<server::HarakaPackets>
+server::ServerController::_encode_delta_update(
     const core::DeltaSnapshot& delta,
     const std::vector<core::ActionStatus>& status_list,
     const std::vector<std::shared_ptr<core::GameAction>>& actions)
 {
-    server::serialization::DeltaSnapshotUpdate update;
+    auto* update = google::protobuf::Arena::CreateMessage<
+        server::serialization::DeltaSnapshotUpdate>(_message_arena.get());
+    update->set_tick(delta.next_tick());
 
-    // prepares the buffer containing all the update information
-    auto delta_buffer = delta.serialize();
-    update.set_allocated_delta_snapshot(&delta_buffer);
+    // prepares the buffer containing all the update information, the objects
+    // are serialized in place by the workers
+    delta.serialize_to(update->mutable_delta_snapshot(), _workers);
 
+    update->mutable_status_list()->Reserve(status_list.size());
     for (auto const& status : status_list) {
-        auto serialized_status = status.serialize();
-        auto* buffer_status_ptr = update.add_status_list();
-        *buffer_status_ptr = serialized_status;
+        status.serialize_to(update->add_status_list());
     }
 
+    update->mutable_actions()->Reserve(actions.size());
     for (auto const& action : actions) {
-        auto serialized_action = action->serialize();
-        auto* buffer_action_ptr = update.add_actions();
-        *buffer_action_ptr = serialized_action;
+        action->serialize_to(update->add_actions());
     }
 
     // encodes the buffer in a packet
-    auto packet = _encode_packet(&delta_buffer, server::DELTA_SNAPSHOT_RESULT);
+    return _encode_packet(update, server::DELTA_SNAPSHOT_RESULT);
+}
+
+net::Packet<server::HarakaPackets>
+server::ServerController::_encode_full_snapshot(
+    core::GameInstance const& instance)
+{
+    auto* snapshot = google::protobuf::Arena::CreateMessage<
+        core::serialization::Snapshot>(_message_arena.get());
+    instance.current_snapshot().serialize_to(snapshot);
+    return _encode_packet(snapshot, server::FULL_SNAPSHOT_RESULT);
+}
+
+void server::ServerController::_reset_message_arena()
+{
+    std::size_t space = _message_arena ? _message_arena->SpaceAllocated() : 0;
+    if (_message_arena && space <= _message_arena_block.size()) {
+        _message_arena->Reset();
+        return;
+    }
+
+    // the arena must be destroyed before its initial block
+    _message_arena.reset();
+    _message_arena_block.resize(std::max<std::size_t>(space, 64 * 1024));
+    google::protobuf::ArenaOptions options;
+    options.initial_block = _message_arena_block.data();
+    options.initial_block_size = _message_arena_block.size();
+    _message_arena = std::make_unique<google::protobuf::Arena>(options);
+}
+
+server::SessionInfo* server::ServerController::_find_session_info(
+    std::shared_ptr<net::Session<HarakaPackets>> const& client)
+{
+    return client ? _session_info.get(client->user_key()) : nullptr;
+}
+
+void server::ServerController::_erase_disconnected_session_info()
+{
+    std::vector<util::slot_key_t> disconnected;
+    std::size_t position = 0;
+    for (auto const& session_info : _session_info) {
+        if (!session_info.logged()) {
+            disconnected.push_back(_session_info.key_at(position));
+        }
+        position++;
+    }
+
+    for (auto key : disconnected) {
+        if (auto* shard = _find_shard(*_session_info.get(key))) {
+            shard->session_count--;
+        }
+        _session_info.erase(key);
+    }
+}
+
+server::ServerController::Shard* server::ServerController::_route_session(
+    server::SessionInfo& session_info, util::slot_key_t requested)
+{
+    // the requested key comes from the client, only the keys of the live
+    // instances are honoured
+    auto key = util::null_slot_key;
+    if (requested != util::null_slot_key && _shards.contains(requested)) {
+        key = requested;
+    }
+    else {
+        // packs the clients evenly over the instances
+        std::size_t session_count = -1;
+        for (std::size_t i = 0; i < _shards.size(); i++) {
+            auto const& shard = *(_shards.begin() + i);
+            if (shard.session_count < session_count) {
+                session_count = shard.session_count;
+                key = _shards.key_at(i);
+            }
+        }
+    }
 
-    // sends the packet
-    message_all_clients(packet);
+    if (auto* previous = _find_shard(session_info)) {
+        previous->session_count--;
+    }
+    session_info.set_instance(key);
+
+    auto* shard = _shards.get(key);
+    if (shard != nullptr) {
+        shard->session_count++;
+    }
+    return shard;
+}
+
+server::ServerController::Shard*
+server::ServerController::_find_shard(server::SessionInfo const& session_info)
+{
+    return _shards.get(session_info.instance());
+}
+
+void server::ServerController::_parse_snapshot_ack(
+    server::SessionInfo& session_info,
+    core::GameInstance const& instance,
+    net::Packet<HarakaPackets> const& ack_packet)
+{
+    auto ack_buffer = _decode_packet<serialization::SnapshotAck>(ack_packet);
+    if (ack_buffer.tick() <= instance.current_snapshot().tick()) {
+        session_info.acknowledge(ack_buffer.tick());
+    }
 }
 
 void server::ServerController::_parse_connection_result(
-    std::shared_ptr<net::TCPSession<HarakaPackets>> client,
+    std::shared_ptr<net::Session<HarakaPackets>> client,
     net::Packet<HarakaPackets>& connection_result)
 {
     // TODO check if session doesn't already exists
@@ -160,7 +406,9 @@ void server::ServerController::_parse_connection_result(
 
         message_client(client, accepted_packet);
 
-        _session_info.push_back(info);
+        auto key = _session_info.insert(info);
+        _route_session(*_session_info.get(key), connection_buffer.instance());
+        client->set_user_key(key);
     }
     else {
         info.disconnect();
@@ -1,7 +1,7 @@
 #include "server/session_info.hpp"
 
 server::SessionInfo::SessionInfo(
-    const std::shared_ptr<net::TCPSession<HarakaPackets>>& session)
+    const std::shared_ptr<net::Session<HarakaPackets>>& session)
     : _session(session)
 {
 }
@@ -9,7 +9,7 @@ server::SessionInfo::SessionInfo(
 bool server::SessionInfo::log(
     std::string username,
     std::string token,
-    std::shared_ptr<net::TCPSession<HarakaPackets>> const& reconnection)
+    std::shared_ptr<net::Session<HarakaPackets>> const& reconnection)
 {
     // TODO later: contact main api to check credentials
     _username = std::move(username);
@@ -28,8 +28,8 @@ bool server::SessionInfo::logged() const
     return _status == LOGGED;
 }
 
-std::shared_ptr<net::TCPSession<server::HarakaPackets>>
-server::SessionInfo::session()
+std::shared_ptr<net::Session<server::HarakaPackets>>
+server::SessionInfo::session() const
 {
     return _session;
 }
@@ -37,5 +37,35 @@ server::SessionInfo::session()
 void server::SessionInfo::disconnect()
 {
     _status = DISCONNECTED;
+    _has_baseline = false;
     _session.reset();
 }
+
+void server::SessionInfo::acknowledge(std::uint32_t tick)
+{
+    if (!_has_baseline || tick > _acked_tick) {
+        _acked_tick = tick;
+        _has_baseline = true;
+    }
+}
+
+bool server::SessionInfo::has_baseline() const
+{
+    return _has_baseline;
+}
+
+std::uint32_t server::SessionInfo::acked_tick() const
+{
+    return _acked_tick;
+}
+
+void server::SessionInfo::set_instance(util::slot_key_t key)
+{
+    _instance = key;
+    _has_baseline = false;
+}
+
+util::slot_key_t server::SessionInfo::instance() const
+{
+    return _instance;
+}
@@ -0,0 +1,96 @@
+#include "util/arena.hpp"
+#include <algorithm>
+#include <cstdint>
+
+util::Arena::Arena(std::size_t initial_size) : _initial_size(initial_size)
+{
+}
+
+void util::Arena::reset()
+{
+    std::scoped_lock lock(_mutex);
+    if (_blocks.size() > 1) {
+        // the last cycle needed all these blocks, the next one gets them in
+        // a single block
+        auto total = _capacity();
+        _blocks.clear();
+        _add_block(total);
+    }
+    else if (!_blocks.empty()) {
+        _blocks.front()->used.store(0, std::memory_order_relaxed);
+    }
+}
+
+std::size_t util::Arena::used() const
+{
+    std::scoped_lock lock(_mutex);
+    std::size_t used = 0;
+    for (auto const& block : _blocks) {
+        used += block->used.load(std::memory_order_relaxed);
+    }
+    return used;
+}
+
+std::size_t util::Arena::capacity() const
+{
+    std::scoped_lock lock(_mutex);
+    return _capacity();
+}
+
+std::size_t util::Arena::block_count() const
+{
+    std::scoped_lock lock(_mutex);
+    return _blocks.size();
+}
+
+std::size_t util::Arena::_capacity() const
+{
+    std::size_t capacity = 0;
+    for (auto const& block : _blocks) {
+        capacity += block->size;
+    }
+    return capacity;
+}
+
+void* util::Arena::do_allocate(std::size_t bytes, std::size_t alignment)
+{
+    for (;;) {
+        auto* block = _current.load(std::memory_order_acquire);
+        if (block != nullptr) {
+            if (auto* pointer = _try_allocate(*block, bytes, alignment)) {
+                return pointer;
+            }
+        }
+
+        std::scoped_lock lock(_mutex);
+        // another thread may have added a block in the meantime
+        if (_current.load(std::memory_order_relaxed) == block) {
+            _add_block(bytes + alignment);
+        }
+    }
+}
+
+void* util::Arena::_try_allocate(Block& block,
+                                 std::size_t bytes,
+                                 std::size_t alignment)
+{
+    auto base = reinterpret_cast<std::uintptr_t>(block.data.get());
+    auto used = block.used.load(std::memory_order_relaxed);
+    for (;;) {
+        auto offset = ((base + used + alignment - 1) & ~(alignment - 1)) - base;
+        if (offset + bytes > block.size) {
+            return nullptr;
+        }
+        if (block.used.compare_exchange_weak(
+                used, offset + bytes, std::memory_order_relaxed)) {
+            return block.data.get() + offset;
+        }
+    }
+}
+
+void util::Arena::_add_block(std::size_t min_size)
+{
+    auto size = _blocks.empty() ? _initial_size : 2 * _blocks.back()->size;
+    _blocks.push_back(std::make_unique<Block>(std::max(size, min_size)));
+    _current.store(_blocks.back().get(), std::memory_order_release);
+}
@@ -0,0 +1,73 @@
+#include "util/thread_pool.hpp"
+
+util::ThreadPool::ThreadPool(std::size_t thread_count)
+{
+    _workers.reserve(thread_count);
+    for (std::size_t i = 0; i < thread_count; i++) {
+        _workers.emplace_back([this]() { _work(); });
+    }
+}
+
+util::ThreadPool::~ThreadPool()
+{
+    {
+        std::scoped_lock lock(_mutex);
+        _stopping = true;
+    }
+    _condition.notify_all();
+
+    for (auto& worker : _workers) {
+        worker.join();
+    }
+}
+
+void util::ThreadPool::submit(std::function<void()> task)
+{
+    if (_workers.empty()) {
+        task();
+        return;
+    }
+    {
+        std::scoped_lock lock(_mutex);
+        _tasks.push_back(std::move(task));
+    }
+    _condition.notify_one();
+}
+
+std::size_t util::ThreadPool::size() const
+{
+    return _workers.size();
+}
+
+bool util::ThreadPool::_run_pending_task()
+{
+    std::function<void()> task;
+    {
+        std::scoped_lock lock(_mutex);
+        if (_tasks.empty()) {
+            return false;
+        }
+        task = std::move(_tasks.front());
+        _tasks.pop_front();
+    }
+    task();
+    return true;
+}
+
+void util::ThreadPool::_work()
+{
+    for (;;) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _condition.wait(lock,
+                            [this]() { return _stopping || !_tasks.empty(); });
+            if (_tasks.empty()) {
+                return;
+            }
+            task = std::move(_tasks.front());
+            _tasks.pop_front();
+        }
+        task();
+    }
+}
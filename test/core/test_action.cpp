@@ -2,7 +2,9 @@
 #include "core/game_object.hpp"
 #include "core/gameinstance.hpp"
 #include "core/types.hpp"
+#include <google/protobuf/arena.h>
 #include <google/protobuf/util/json_util.h>
+#include <google/protobuf/util/message_differencer.h>
 #include <gtest/gtest.h>
 #include <memory>
 
@@ -31,9 +33,11 @@ public:
     }
 
 protected:
+    static inline const core::ValueSchema value_schema{"health"};
+
     void add_values() override
     {
-        _values["health"] = &_health;
+        _values.bind(value_schema, {&_health});
     }
 
 public:
@@ -138,10 +142,11 @@ public:
     }
 
 protected:
+    static inline const core::ValueSchema value_schema{"position", "team"};
+
     void add_values() override
     {
-        _values["position"] = &_pos;
-        _values["team"] = &_team;
+        _values.bind(value_schema, {&_pos, &_team});
     }
 
 public:
@@ -247,6 +252,16 @@ TEST_F(ActionTest, test_serialize_action)
     auto deserialized_action = core::GameAction::deserialize(serialized_action);
 
     ASSERT_EQ(action->id(), deserialized_action->id());
+
+    // built in place on an arena, same message
+    google::protobuf::Arena arena;
+    auto* action_buffer =
+        google::protobuf::Arena::CreateMessage<core::serialization::Action>(
+            &arena);
+    action->serialize_to(action_buffer);
+    ASSERT_EQ(action_buffer->GetArena(), &arena);
+    ASSERT_TRUE(google::protobuf::util::MessageDifferencer::Equals(
+        *action_buffer, serialized_action));
 }
 
 TEST_F(ActionTest, test_serialize_action_status)
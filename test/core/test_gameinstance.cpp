@@ -39,10 +39,11 @@ public:
     }
 
 protected:
+    static inline const core::ValueSchema value_schema{"position", "speed"};
+
     void add_values() override
     {
-        _values["position"] = &_pos;
-        _values["speed"] = &_speed;
+        _values.bind(value_schema, {&_pos, &_speed});
     }
 
 private:
@@ -66,3 +67,34 @@ TEST_F(GameInstanceTest, test_delta_update)
     ASSERT_FLOAT_EQ(delta_position->x(), .5f * (1.f / 15.f));
     ASSERT_FLOAT_EQ(delta_position->y(), .0f);
 }
+
+TEST_F(GameInstanceTest, test_snapshot_history)
+{
+    auto object = std::make_shared<DummyObject>(
+        0, core::vec2f_t(.0f, .0f), core::vec2f_t(.5f, .0f));
+    core::Snapshot snapshot(0);
+    snapshot.add_object(object);
+
+    core::GameInstance instance(snapshot, true, 15, 2);
+    auto first_tick = instance.current_snapshot().tick();
+    for (int i = 0; i < 3; i++) {
+        instance.update_tick();
+    }
+
+    auto tick = instance.current_snapshot().tick();
+    ASSERT_EQ(tick, first_tick + 3);
+    ASSERT_EQ(instance.snapshot_at(tick), &instance.current_snapshot());
+    ASSERT_EQ(instance.snapshot_at(first_tick), nullptr);
+    ASSERT_EQ(instance.snapshot_at(tick + 1), nullptr);
+
+    // a delta against an older baseline covers all the ticks since
+    auto const* baseline = instance.snapshot_at(first_tick + 1);
+    ASSERT_NE(baseline, nullptr);
+    ASSERT_EQ(baseline->tick(), first_tick + 1);
+
+    core::DeltaSnapshot delta(baseline->tick(), tick);
+    delta.evaluate(*baseline, instance.current_snapshot());
+    auto delta_position =
+        delta.delta_values().at(0).at("position")->cast<core::vec2f_t>();
+    ASSERT_FLOAT_EQ(delta_position->x(), 2.f * .5f * (1.f / 15.f));
+}
@@ -1,5 +1,7 @@
 #include "core/exception.hpp"
 #include "core/game_object.hpp"
+#include "core/value_column.hpp"
+#include "util/thread_pool.hpp"
 #include <google/protobuf/util/json_util.h>
 #include <gtest/gtest.h>
 
@@ -54,9 +56,11 @@ public:
     }
 
 protected:
+    static inline const core::ValueSchema value_schema{"value"};
+
     void add_values() override
     {
-        _values["value"] = &_value;
+        _values.bind(value_schema, {&_value});
     }
 
 private:
@@ -111,10 +115,11 @@ public:
     }
 
 protected:
+    static inline const core::ValueSchema value_schema{"position", "health"};
+
     void add_values() override
     {
-        _values["position"] = &_position;
-        _values["health"] = &_health;
+        _values.bind(value_schema, {&_position, &_health});
     }
 
 private:
@@ -125,6 +130,72 @@ private:
     static core::Registrar registrar;
 };
 
+class ColumnDummyObject : public core::GameObject {
+public:
+    /**
+     * Columns of the objects, owned by each test.
+     */
+    struct Columns {
+        core::ValueColumn<core::vec2f_t> position;
+        core::ValueColumn<core::int_value_t> health;
+    };
+
+    ColumnDummyObject(Columns& columns,
+                      std::uint32_t id,
+                      float x,
+                      float y,
+                      int a)
+        : core::GameObject(id),
+          _position(columns.position, x, y),
+          _health(columns.health, a)
+    {
+        add_values();
+    }
+
+    ColumnDummyObject(ColumnDummyObject const& other)
+        : core::GameObject(other._id),
+          _position(other._position),
+          _health(other._health)
+    {
+        add_values();
+    }
+
+    void react_event(Observable* observer, core::Event& event) override
+    {
+    }
+
+    void update(float delta_time) override
+    {
+    }
+
+    std::unique_ptr<GameObject> clone() override
+    {
+        return std::make_unique<ColumnDummyObject>(*this);
+    }
+
+    std::string type_name() const override
+    {
+        return "ColumnDummyObject";
+    }
+
+    core::vec2f_t const* position() const
+    {
+        return _position.get();
+    }
+
+protected:
+    static inline const core::ValueSchema value_schema{"position", "health"};
+
+    void add_values() override
+    {
+        _values.bind(value_schema, {_position.get(), _health.get()});
+    }
+
+private:
+    core::ColumnValue<core::vec2f_t> _position;
+    core::ColumnValue<core::int_value_t> _health;
+};
+
 core::Registrar DummyObject::registrar("DummyObject", DummyObject::create);
 core::Registrar ComplexDummyObject::registrar("ComplexDummyObject",
                                               ComplexDummyObject::create);
@@ -211,3 +282,115 @@ TEST_F(ObjectTest, test_object_serialization)
                   ->value());
     ASSERT_EQ(dummy_object->checksum(), dummy_object_deserialized->checksum());
 }
+
+TEST_F(ObjectTest, test_object_unpack)
+{
+    auto dummy_object = std::make_unique<DummyObject>(0, 50);
+    core::BitWriter writer;
+    dummy_object->pack(writer);
+    auto bytes = writer.finish();
+    core::BitReader reader(bytes.data(), bytes.size());
+    auto unpacked = core::GameObject::unpack(reader, 3);
+    ASSERT_EQ(unpacked->id(), 3);
+    ASSERT_EQ(unpacked->checksum(), dummy_object->checksum());
+
+    // the type name length comes from the network, it is checked against
+    // the remaining bytes before allocating the name
+    core::BitWriter huge_writer;
+    huge_writer.write_varint(std::uint64_t(1) << 40);
+    huge_writer.write_bytes("DummyObject", 11);
+    auto huge_bytes = huge_writer.finish();
+    core::BitReader huge_reader(huge_bytes.data(), huge_bytes.size());
+    ASSERT_THROW(core::GameObject::unpack(huge_reader, 0),
+                 core::BufferOverflowException);
+
+    // and against a sane maximum, even when the bytes are there
+    std::string long_name(core::GameObject::max_type_name_size + 1, 'a');
+    core::BitWriter long_writer;
+    long_writer.write_varint(long_name.size());
+    long_writer.write_bytes(long_name.data(), long_name.size());
+    auto long_bytes = long_writer.finish();
+    core::BitReader long_reader(long_bytes.data(), long_bytes.size());
+    ASSERT_THROW(core::GameObject::unpack(long_reader, 0),
+                 core::BufferOverflowException);
+}
+
+TEST_F(ObjectTest, test_column_storage)
+{
+    ColumnDummyObject::Columns columns;
+    auto object =
+        std::make_unique<ColumnDummyObject>(columns, 0, 0.5f, 1.0f, 10);
+    auto object_2 =
+        std::make_unique<ColumnDummyObject>(columns, 1, 0.5f, 1.0f, 10);
+    auto member_object =
+        std::make_unique<ComplexDummyObject>(0, 0.5f, 1.0f, 10);
+
+    // values of the same field are packed together
+    ASSERT_EQ(object->position() + 1, object_2->position());
+    ASSERT_EQ(columns.position.size(), 2);
+
+    // column storage doesn't change the object state
+    ASSERT_EQ(object->checksum(), member_object->checksum());
+
+    auto clone = object->clone();
+    ASSERT_EQ(columns.position.size(), 3);
+    ASSERT_EQ(clone->checksum(), object->checksum());
+    ASSERT_NE(clone->get_value("position"), object->get_value("position"));
+
+    // released slots are reused
+    auto const* released_position = object_2->position();
+    object_2.reset();
+    clone.reset();
+    ASSERT_EQ(columns.position.size(), 1);
+    auto object_3 =
+        std::make_unique<ColumnDummyObject>(columns, 2, 0.0f, 0.0f, 1);
+    ASSERT_EQ(object_3->position(), released_position);
+
+    float sum = 0.0f;
+    columns.position.for_each(
+        [&sum](core::vec2f_t& position) { sum += position.x(); });
+    ASSERT_FLOAT_EQ(sum, 0.5f);
+}
+
+TEST_F(ObjectTest, test_column_concurrent_clones)
+{
+    // the workers clone the objects while the column grows
+    ColumnDummyObject::Columns columns;
+    auto object =
+        std::make_unique<ColumnDummyObject>(columns, 0, 0.5f, 1.0f, 10);
+    std::vector<std::unique_ptr<core::GameObject>> clones(2000);
+    util::ThreadPool pool(4);
+    pool.parallel_for(clones.size(), [&](std::size_t index) {
+        clones[index] = object->clone();
+    });
+
+    for (auto const& clone : clones) {
+        ASSERT_EQ(clone->checksum(), object->checksum());
+    }
+    ASSERT_EQ(columns.position.size(), clones.size() + 1);
+}
+
+TEST_F(ObjectTest, test_value_schema)
+{
+    auto object = std::make_unique<ComplexDummyObject>(0, 0.5f, 1.0f, 10);
+    auto const* schema = object->schema();
+
+    ASSERT_NE(schema, nullptr);
+    ASSERT_EQ(schema->size(), 2);
+    ASSERT_EQ(schema->name(schema->index("health")), "health");
+    ASSERT_EQ(object->get_value(schema->index("position")),
+              object->get_value("position"));
+
+    ASSERT_THROW(static_cast<void>(schema->index("not_a_field")),
+                 core::UnknownFieldException);
+
+    ASSERT_THROW(
+        core::ValueSchema({{"position", core::Quantization{0.1f, 0}}}),
+        core::InvalidQuantizationException);
+    ASSERT_THROW(
+        core::ValueSchema({{"position", core::Quantization{0.1f, 64}}}),
+        core::InvalidQuantizationException);
+    ASSERT_THROW(
+        core::ValueSchema({{"position", core::Quantization{0.0f, 16}}}),
+        core::InvalidQuantizationException);
+}
@@ -1,11 +1,10 @@
 #include "core/exception.hpp"
 #include "core/snapshot.hpp"
+#include "core/snapshot_history.hpp"
 #include <google/protobuf/util/json_util.h>
+#include <google/protobuf/util/message_differencer.h>
 #include <gtest/gtest.h>
 
-class SnapshotTest : public ::testing::Test {
-};
-
 class DummyObject : public core::GameObject {
 public:
     DummyObject(std::uint32_t id, float x, float y)
@@ -55,9 +54,12 @@ public:
     }
 
 private:
+    static inline const core::ValueSchema value_schema{
+        {"position", core::Quantization{0.001f, 16}}};
+
     virtual void add_values() override
     {
-        _values["position"] = &_position;
+        _values.bind(value_schema, {&_position});
     }
 
     core::vec2f_t _position;
@@ -114,9 +116,11 @@ public:
     }
 
 private:
+    static inline const core::ValueSchema value_schema{"health"};
+
     virtual void add_values() override
     {
-        _values["health"] = &_health;
+        _values.bind(value_schema, {&_health});
     }
 
     core::int_value_t _health;
@@ -124,9 +128,101 @@ private:
     static core::Registrar registrar;
 };
 
+/**
+ * Object following the previous one: its update reads the counter of the
+ * object of id - 1 in the previous snapshot.
+ */
+class ChainObject : public core::GameObject {
+public:
+    ChainObject(std::uint32_t id) : core::GameObject(id), _counter(0)
+    {
+        add_values();
+    }
+
+    ChainObject(ChainObject const& other)
+        : core::GameObject(other._id), _counter(other._counter)
+    {
+        add_values();
+    }
+
+    void update(float delta_time) override
+    {
+    }
+
+    void update(float delta_time, core::Snapshot const& previous) override
+    {
+        auto predecessor = previous.get_object(_id - 1);
+        if (predecessor != nullptr) {
+            _counter = core::int_value_t(counter(*predecessor) + 1);
+        }
+    }
+
+    void react_event(Observable* observer, core::Event& event) override
+    {
+    }
+
+    std::unique_ptr<GameObject> clone() override
+    {
+        return std::make_unique<ChainObject>(*this);
+    }
+
+    std::string type_name() const override
+    {
+        return "ChainObject";
+    }
+
+    static int counter(core::GameObject const& object)
+    {
+        return object.get_value("counter")
+            ->cst_cast<core::int_value_t>()
+            ->get_value();
+    }
+
+private:
+    static inline const core::ValueSchema value_schema{"counter"};
+
+    void add_values() override
+    {
+        _values.bind(value_schema, {&_counter});
+    }
+
+    core::int_value_t _counter;
+};
+
 core::Registrar DummyObject::registrar("DummyObject", DummyObject::create);
 core::Registrar DummyObject2::registrar("DummyObject2", DummyObject2::create);
 
+class SnapshotTest : public ::testing::Test {
+protected:
+    /**
+     * @return a snapshot of tick 0 with count DummyObjects, the position of
+     * each object being (id, id).
+     */
+    static core::Snapshot make_snapshot(std::uint32_t count)
+    {
+        core::Snapshot snapshot(0);
+        for (std::uint32_t id = 0; id < count; id++) {
+            snapshot.add_object(
+                std::make_shared<DummyObject>(id, (float) id, (float) id));
+        }
+        return snapshot;
+    }
+
+    /**
+     * Replaces every step-th object of id lower than count by a new
+     * DummyObject.
+     */
+    static void replace_objects(core::Snapshot& snapshot,
+                                std::uint32_t count,
+                                std::uint32_t step)
+    {
+        for (std::uint32_t id = 0; id < count; id += step) {
+            snapshot.delete_object(id);
+            snapshot.add_object(std::make_shared<DummyObject>(id, 0.5f, 1.5f));
+        }
+    }
+};
+
 TEST_F(SnapshotTest, compare_delta)
 {
     core::Snapshot snap_1(0);
@@ -276,6 +372,69 @@ TEST_F(SnapshotTest, snapshot_deep_copy)
         snap_2_obj_2->get_value("position")->cst_cast<core::vec2f_t>()->y());
 }
 
+TEST_F(SnapshotTest, snapshot_copy_on_write)
+{
+    core::Snapshot snap_1(0);
+
+    snap_1.add_object(std::make_shared<DummyObject2>(0, 10));
+    snap_1.add_object(std::make_shared<DummyObject>(1, 0.5f, 0.5f));
+
+    core::Snapshot snap_2(snap_1);
+    core::Snapshot const& const_snap_1 = snap_1;
+    core::Snapshot const& const_snap_2 = snap_2;
+
+    // objects are shared until mutated
+    ASSERT_EQ(const_snap_1.get_object(0).get(),
+              const_snap_2.get_object(0).get());
+    ASSERT_EQ(const_snap_1.get_object(1).get(),
+              const_snap_2.get_object(1).get());
+
+    // mutable access clones the object in the snapshot only
+    auto const* shared_obj = const_snap_1.get_object(0).get();
+    auto mutated_obj = snap_2.get_object(0);
+    ASSERT_NE(mutated_obj.get(), shared_obj);
+    ASSERT_EQ(const_snap_1.get_object(0).get(), shared_obj);
+    ASSERT_EQ(snap_2.get_object(0).get(), mutated_obj.get());
+
+    // unchanged shared objects don't appear in the delta
+    core::DeltaSnapshot delta(snap_1.tick(), snap_2.tick());
+    delta.evaluate(snap_1, snap_2);
+    ASSERT_EQ(delta.delta_values().count(1), 0);
+}
+
+TEST_F(SnapshotTest, dirty_objects_delta)
+{
+    core::Snapshot snap_1(0);
+
+    snap_1.add_object(std::make_shared<DummyObject2>(0, 10));
+    snap_1.add_object(std::make_shared<DummyObject2>(1, 10));
+    snap_1.add_object(std::make_shared<DummyObject2>(2, 10));
+
+    core::Snapshot snap_2(snap_1);
+    snap_2.get_object(0);
+    snap_2.delete_object(1);
+    snap_2.add_object(std::make_shared<DummyObject2>(3, 10));
+
+    // only the dirty objects are visited, the unchanged one is dropped
+    core::DeltaSnapshot delta(snap_1.tick(), snap_2.tick());
+    delta.evaluate(snap_1, snap_2);
+
+    ASSERT_EQ(delta.delta_values().count(0), 0);
+    ASSERT_EQ(delta.delta_values().count(2), 0);
+    ASSERT_EQ(delta.deleted_objects().size(), 1);
+    ASSERT_EQ(delta.deleted_objects().at(0), 1);
+    ASSERT_EQ(delta.added_objects().size(), 1);
+    ASSERT_EQ(delta.added_objects().count(3), 1);
+
+    // the checksum verification skips the unchanged object
+    core::DeltaSnapshot verified_delta(snap_1.tick(), snap_2.tick());
+    verified_delta.evaluate(snap_1, snap_2, true);
+
+    ASSERT_EQ(verified_delta.delta_values().count(0), 0);
+    ASSERT_EQ(verified_delta.deleted_objects(), delta.deleted_objects());
+    ASSERT_EQ(verified_delta.added_objects().size(), 1);
+}
+
 TEST_F(SnapshotTest, test_apply_snapshot)
 {
     core::Snapshot snap_1(0);
@@ -455,3 +614,237 @@ TEST_F(SnapshotTest, test_deltasnapshot_serialization)
         }
     }
 }
+
+TEST_F(SnapshotTest, test_deltasnapshot_packed_serialization)
+{
+    core::Snapshot snapshot_1(0);
+    core::Snapshot snapshot_2(1);
+
+    auto obj_1 = std::make_shared<DummyObject>(0, 1.0f, 1.0f);
+    auto obj_2 = std::make_shared<DummyObject>(1, 1.0f, 1.0f);
+    auto obj_3 = std::make_shared<DummyObject>(3, 2.0f, 2.0f);
+    snapshot_1.add_object(obj_1);
+    snapshot_1.add_object(obj_2);
+    snapshot_1.add_object(obj_3);
+
+    auto obj_4 = std::make_shared<DummyObject>(0, 1.5123f, 0.5f);
+    auto obj_5 = std::make_shared<DummyObject>(2, 1.5f, 1.5f);
+    auto obj_6 = std::make_shared<DummyObject>(3, 2.0f, 2.0f);
+    snapshot_2.add_object(obj_4);
+    snapshot_2.add_object(obj_5);
+    snapshot_2.add_object(obj_6);
+
+    core::DeltaSnapshot delta_snapshot(0, 1);
+    delta_snapshot.evaluate(snapshot_1, snapshot_2);
+
+    auto packed = delta_snapshot.serialize_packed(snapshot_2);
+    ASSERT_LT(packed.size(), delta_snapshot.serialize().ByteSizeLong());
+
+    auto deserialized_delta =
+        core::DeltaSnapshot::deserialize_packed(packed, snapshot_1);
+
+    ASSERT_EQ(deserialized_delta.prev_tick(), 0);
+    ASSERT_EQ(deserialized_delta.next_tick(), 1);
+    ASSERT_EQ(deserialized_delta.deleted_objects().size(), 1);
+    ASSERT_EQ(deserialized_delta.deleted_objects().at(0), obj_2->id());
+    ASSERT_EQ(deserialized_delta.added_objects().at(2)->checksum(),
+              obj_5->checksum());
+
+    // the unchanged object is not sent
+    ASSERT_EQ(deserialized_delta.delta_values().count(3), 0);
+    auto position = deserialized_delta.delta_values()
+                               .at(0)
+                               .at("position")
+                               ->cast<core::vec2f_t>();
+    ASSERT_NEAR(position->x(), 0.5123f, 0.001f);
+    ASSERT_NEAR(position->y(), -0.5f, 0.001f);
+}
+
+TEST_F(SnapshotTest, test_packed_quantization_drift)
+{
+    core::Snapshot server_snapshot(0);
+    server_snapshot.add_object(std::make_shared<DummyObject>(0, 0.0f, 0.0f));
+    core::Snapshot client_snapshot(server_snapshot);
+
+    // each move is below the precision of the position, a quantized delta
+    // would be rounded to zero every tick
+    for (std::uint32_t tick = 1; tick <= 100; tick++) {
+        core::Snapshot next_snapshot(tick);
+        next_snapshot.add_object(
+            std::make_shared<DummyObject>(0, 0.0004f * tick, 0.0f));
+
+        core::DeltaSnapshot delta(tick - 1, tick);
+        delta.evaluate(server_snapshot, next_snapshot);
+        auto received = core::DeltaSnapshot::deserialize_packed(
+            delta.serialize_packed(next_snapshot), client_snapshot);
+        client_snapshot = client_snapshot.apply(received);
+        server_snapshot = next_snapshot;
+    }
+
+    auto client_object =
+        std::static_pointer_cast<DummyObject>(client_snapshot.get_object(0));
+    ASSERT_NEAR(client_object->position().x(), 0.04f, 0.001f);
+}
+
+TEST_F(SnapshotTest, test_snapshot_history)
+{
+    core::SnapshotHistory history(4, 5, 2);
+    auto obj = std::make_shared<DummyObject>(0, 1.0f, 1.0f);
+
+    for (std::uint32_t tick = 0; tick < 20; tick++) {
+        core::Snapshot snapshot(tick);
+        snapshot.add_object(obj);
+        history.push(std::move(snapshot),
+                     std::make_shared<core::DeltaSnapshot>(tick, tick + 1));
+    }
+
+    // the memory is bounded to the last ticks and keyframes
+    ASSERT_EQ(history.size(), 4);
+    ASSERT_EQ(history.oldest_tick(), 16);
+    ASSERT_EQ(history.latest_tick(), 19);
+    for (std::uint32_t tick = 16; tick < 20; tick++) {
+        ASSERT_EQ(history.snapshot_at(tick)->tick(), tick);
+        ASSERT_EQ(history.delta_from(tick)->next_tick(), tick + 1);
+    }
+    ASSERT_EQ(history.snapshot_at(14), nullptr);
+    ASSERT_EQ(history.delta_from(14), nullptr);
+
+    // keyframes reach further, at a coarser granularity
+    ASSERT_EQ(history.snapshot_at(10)->tick(), 10);
+    ASSERT_EQ(history.snapshot_at(10)->get_object(0)->checksum(),
+              obj->checksum());
+    ASSERT_EQ(history.keyframe_before(14)->tick(), 10);
+    ASSERT_EQ(history.snapshot_at(5), nullptr);
+}
+
+TEST_F(SnapshotTest, test_parallel_update)
+{
+    util::ThreadPool pool(4);
+    core::Snapshot previous(0);
+    for (std::uint32_t id = 0; id < 1000; id++) {
+        previous.add_object(std::make_shared<ChainObject>(id));
+    }
+
+    // the objects only see the previous counters, whatever the update order
+    core::Snapshot next(previous);
+    next.update(1.0f, previous, pool, 16);
+    core::Snapshot const& const_next = next;
+    for (std::uint32_t id = 0; id < 1000; id++) {
+        ASSERT_EQ(ChainObject::counter(*const_next.get_object(id)),
+                  id == 0 ? 0 : 1);
+        ASSERT_EQ(ChainObject::counter(*previous.get_object(id)), 0);
+        ASSERT_NE(const_next.get_object(id).get(),
+                  previous.get_object(id).get());
+    }
+
+    core::Snapshot last(next);
+    last.update(1.0f, next, pool);
+    core::Snapshot const& const_last = last;
+    ASSERT_EQ(ChainObject::counter(*const_last.get_object(1)), 1);
+    ASSERT_EQ(ChainObject::counter(*const_last.get_object(999)), 2);
+}
+
+TEST_F(SnapshotTest, test_parallel_delta)
+{
+    util::ThreadPool pool(4);
+    auto prev_snap = make_snapshot(3000);
+    core::Snapshot next_snap(prev_snap);
+    replace_objects(next_snap, 3000, 7);
+    for (std::uint32_t id = 1; id < 3000; id += 100) {
+        next_snap.delete_object(id);
+    }
+    for (std::uint32_t id = 3000; id < 3300; id++) {
+        next_snap.add_object(std::make_shared<DummyObject>(id, 1.0f, 1.0f));
+    }
+
+    for (bool verify : {false, true}) {
+        core::DeltaSnapshot serial_delta(prev_snap.tick(), next_snap.tick());
+        serial_delta.evaluate(prev_snap, next_snap, verify);
+        core::DeltaSnapshot parallel_delta(prev_snap.tick(), next_snap.tick());
+        parallel_delta.evaluate(prev_snap, next_snap, pool, verify);
+
+        ASSERT_EQ(parallel_delta.deleted_objects(),
+                  serial_delta.deleted_objects());
+        ASSERT_EQ(parallel_delta.added_objects(), serial_delta.added_objects());
+        ASSERT_EQ(parallel_delta.delta_values().size(),
+                  serial_delta.delta_values().size());
+
+        auto serial_buffer = serial_delta.serialize();
+        auto parallel_buffer = parallel_delta.serialize(pool);
+        ASSERT_EQ(parallel_buffer.added_objects_size(),
+                  serial_buffer.added_objects_size());
+        ASSERT_EQ(parallel_buffer.deleted_objects_size(),
+                  serial_buffer.deleted_objects_size());
+        for (auto const& pair : serial_buffer.delta_objects()) {
+            ASSERT_EQ(
+                parallel_buffer.delta_objects().at(pair.first).packed_values(),
+                pair.second.packed_values());
+        }
+    }
+}
+
+TEST_F(SnapshotTest, test_delta_arena)
+{
+    util::ThreadPool pool(4);
+    auto prev_snap = make_snapshot(1000);
+    core::Snapshot next_snap(prev_snap);
+    replace_objects(next_snap, 1000, 3);
+
+    auto arena = std::make_shared<util::Arena>(256);
+    for (bool parallel : {false, true}) {
+        // the blocks of the previous cycle are merged
+        arena->reset();
+        ASSERT_LE(arena->block_count(), 1);
+        core::DeltaSnapshot delta(prev_snap.tick(), next_snap.tick(), arena);
+        if (parallel) {
+            delta.evaluate(prev_snap, next_snap, pool, true);
+        }
+        else {
+            delta.evaluate(prev_snap, next_snap, true);
+        }
+
+        // the differences are allocated from the arena, moves keep it
+        ASSERT_EQ(delta.delta_values().size(), 334);
+        ASSERT_GT(arena->used(), 0);
+        core::DeltaSnapshot moved(std::move(delta));
+        for (auto const& [id, differences] : moved.delta_values()) {
+            ASSERT_EQ(differences.get_allocator().resource(), arena.get());
+        }
+
+        // copies don't
+        auto copy = moved.delta_values();
+        ASSERT_EQ(copy.begin()->second.get_allocator().resource(),
+                  std::pmr::get_default_resource());
+    }
+}
+
+TEST_F(SnapshotTest, test_serialize_on_arena)
+{
+    util::ThreadPool pool(4);
+    auto prev_snap = make_snapshot(1000);
+    core::Snapshot next_snap(prev_snap);
+    replace_objects(next_snap, 1000, 3);
+    for (std::uint32_t id = 1000; id < 1500; id++) {
+        next_snap.add_object(std::make_shared<DummyObject>(id, 1.0f, 1.0f));
+    }
+    core::DeltaSnapshot delta(prev_snap.tick(), next_snap.tick());
+    delta.evaluate(prev_snap, next_snap);
+
+    // the messages built in place on an arena match the copied ones
+    google::protobuf::Arena arena;
+    using google::protobuf::util::MessageDifferencer;
+    auto* delta_buffer = google::protobuf::Arena::CreateMessage<
+        core::serialization::DeltaSnapshot>(&arena);
+    delta.serialize_to(delta_buffer, pool);
+    ASSERT_EQ(delta_buffer->GetArena(), &arena);
+    ASSERT_EQ(delta_buffer->delta_objects_size(), 334);
+    ASSERT_TRUE(MessageDifferencer::Equals(*delta_buffer, delta.serialize()));
+
+    auto* snapshot_buffer =
+        google::protobuf::Arena::CreateMessage<core::serialization::Snapshot>(
+            &arena);
+    next_snap.serialize_to(snapshot_buffer);
+    ASSERT_EQ(snapshot_buffer->objects_size(), 1500);
+    ASSERT_TRUE(
+        MessageDifferencer::Equals(*snapshot_buffer, next_snap.serialize()));
+}
@@ -11,7 +11,7 @@ TEST_F(TypeTest, TestIntegerAndFloatType)
     core::value_t delta_integer = fst_integer.get_delta(&snd_integer);
 
     int delta_int_value =
-        delta_integer->cast_shared<core::int_value_t>()->get_value();
+        delta_integer->cast<core::int_value_t>()->get_value();
 
     ASSERT_EQ(delta_int_value, 50);
 
@@ -20,7 +20,7 @@ TEST_F(TypeTest, TestIntegerAndFloatType)
     core::value_t delta_float = fst_float.get_delta(&snd_float);
 
     float delta_float_value =
-        delta_float->cast_shared<core::float_value_t>()->get_value();
+        delta_float->cast<core::float_value_t>()->get_value();
 
     ASSERT_FLOAT_EQ(delta_float_value, 50.0);
 }
@@ -87,3 +87,97 @@ TEST_F(TypeTest, TestInterpolationNoInterpInt)
             middle_grid_1->cast<core::int_value_nointerp_t>()->get_value(), 5);
     }
 }
+
+TEST_F(TypeTest, TestValueBoxInPlace)
+{
+    core::vec2f_t pos(1.0, 5.0);
+    core::vec2f_t new_pos(2.0, 3.0);
+
+    core::value_t delta = pos.get_delta(&new_pos);
+
+    // built-in values are stored in the box itself, not on the heap
+    auto const* box_begin = reinterpret_cast<char const*>(&delta);
+    auto const* value_address = reinterpret_cast<char const*>(delta.get());
+    ASSERT_GE(value_address, box_begin);
+    ASSERT_LT(value_address, box_begin + sizeof(core::value_t));
+
+    // copies keep the dynamic type
+    core::int_value_nointerp_t point(5);
+    core::value_t copy(point);
+    core::value_t copy_2 = copy;
+    ASSERT_NE(copy_2.get(), copy.get());
+    ASSERT_NE(dynamic_cast<core::int_value_nointerp_t*>(copy_2.get()),
+              nullptr);
+
+    pos.change(*delta);
+    ASSERT_FLOAT_EQ(pos.x(), 1.0);
+    ASSERT_FLOAT_EQ(pos.y(), -2.0);
+}
+
+/**
+ * Value too big to be stored in place.
+ */
+class BigValue : public core::float_value_t {
+public:
+    using core::float_value_t::float_value_t;
+
+    void copy_to(core::ValueBox& box) const override
+    {
+        box.emplace<BigValue>(*this);
+    }
+
+    char padding[core::ValueBox::inline_size] = {};
+};
+
+TEST_F(TypeTest, TestValueBoxMove)
+{
+    // moving a heap value steals it
+    core::value_t big;
+    auto* big_value = big.emplace<BigValue>(2.0f);
+    core::value_t moved_big(std::move(big));
+    ASSERT_EQ(moved_big.get(), big_value);
+    ASSERT_FALSE(big);
+
+    // an in place value is copied in the other box
+    core::value_t small(core::float_value_t(3.0f));
+    core::value_t moved_small;
+    moved_small = std::move(small);
+    ASSERT_FALSE(small);
+    ASSERT_EQ(moved_small.get()->checksum(),
+              core::float_value_t(3.0f).checksum());
+
+    moved_small = std::move(moved_big);
+    ASSERT_EQ(moved_small.get(), big_value);
+}
+
+TEST_F(TypeTest, TestBinarySerialization)
+{
+    core::vec2f_t pos(1.5, -2.0);
+    core::int_value_t health(42);
+
+    std::uint8_t buffer[12];
+    ASSERT_EQ(pos.byte_size() + health.byte_size(), sizeof(buffer));
+
+    core::ByteWriter writer(buffer, sizeof(buffer));
+    pos.write(writer);
+    health.write(writer);
+    ASSERT_EQ(writer.remaining(), 0);
+
+    core::vec2f_t read_pos;
+    core::int_value_t read_health;
+    core::ByteReader reader(buffer, sizeof(buffer));
+    read_pos.read(reader);
+    read_health.read(reader);
+
+    ASSERT_FLOAT_EQ(read_pos.x(), 1.5);
+    ASSERT_FLOAT_EQ(read_pos.y(), -2.0);
+    ASSERT_EQ(read_health.get_value(), 42);
+
+    try {
+        health.write(writer);
+        FAIL();
+    }
+    catch (core::BufferOverflowException const& exc) {
+        SUCCEED();
+    }
+}
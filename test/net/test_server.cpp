@@ -2,9 +2,7 @@
 #include "net/server.hpp"
 #include "protobufs/dummy_packets.pb.h"
 #include <gtest/gtest.h>
-
-class TestServer : public ::testing::Test {
-};
+#include <set>
 
 enum DummyPackets : std::uint32_t {
     CONNECTION = 0,
@@ -13,9 +11,86 @@ enum DummyPackets : std::uint32_t {
     CONNECTION_RESPONSE,
 };
 
+class TestServer : public ::testing::Test {
+protected:
+    /**
+     * @return a CONNECTION packet carrying the username.
+     */
+    static net::Packet<DummyPackets>
+    make_connection_packet(std::string const& username)
+    {
+        net::Connection connection_pb;
+        connection_pb.set_username(username);
+
+        net::Packet<DummyPackets> connect_packet;
+        connect_packet.header.id = DummyPackets::CONNECTION;
+        connect_packet.header.size = connection_pb.ByteSizeLong();
+        connect_packet.body.resize(connect_packet.header.size);
+        connection_pb.SerializeToArray(connect_packet.body.data(),
+                                       connect_packet.body.size());
+        return connect_packet;
+    }
+
+    /**
+     * @return a datagram carrying a whole one byte PING message.
+     */
+    static std::vector<std::uint8_t>
+    make_datagram(net::DatagramHeader::Kind kind,
+                  std::uint16_t sequence,
+                  std::uint8_t value = 0)
+    {
+        net::DatagramHeader header;
+        header.kind = kind;
+        header.sequence = sequence;
+        net::PacketHeader<DummyPackets> packet_header;
+        packet_header.id = PING;
+        packet_header.size = 1;
+
+        std::vector<std::uint8_t> datagram(sizeof(header));
+        std::memcpy(datagram.data(), &header, sizeof(header));
+        if (kind == net::DatagramHeader::DATA) {
+            datagram.resize(sizeof(header) + sizeof(packet_header) + 1);
+            std::memcpy(datagram.data() + sizeof(header),
+                        &packet_header,
+                        sizeof(packet_header));
+            datagram.back() = value;
+        }
+        return datagram;
+    }
+
+    /**
+     * Runs the context for a while, then reads the headers of the datagrams
+     * received by the socket.
+     */
+    static std::vector<net::DatagramHeader>
+    receive_datagrams(net::context_t& context,
+                      net::udp_socket_t& socket,
+                      std::chrono::milliseconds duration)
+    {
+        context.restart();
+        context.run_for(duration);
+
+        std::vector<net::DatagramHeader> headers;
+        std::array<std::uint8_t, 2048> buffer;
+        net::udp_endpoint_t sender;
+        while (socket.available() > 0) {
+            auto length =
+                socket.receive_from(boost::asio::buffer(buffer), sender);
+            if (length >= sizeof(net::DatagramHeader)) {
+                headers.emplace_back();
+                std::memcpy(&headers.back(), buffer.data(), sizeof(headers[0]));
+            }
+        }
+        return headers;
+    }
+};
+
 class DummyServer : public net::ServerInterface<DummyPackets> {
 public:
-    DummyServer(std::uint16_t port) : ServerInterface<DummyPackets>(port)
+    DummyServer(std::uint16_t port,
+                std::size_t io_threads = 1,
+                bool udp = false)
+        : ServerInterface<DummyPackets>(port, io_threads, udp)
     {
     }
 
@@ -29,21 +104,26 @@ public:
         return _usernames;
     }
 
+    std::vector<std::size_t>& batch_sizes()
+    {
+        return _batch_sizes;
+    }
+
 protected:
     bool on_client_connect(
-        std::shared_ptr<net::TCPSession<DummyPackets>> client) override
+        std::shared_ptr<net::Session<DummyPackets>> client) override
     {
         std::cout << "[Server] On client connect called. \n";
         return true;
     }
 
     void on_client_disconnect(
-        std::shared_ptr<net::TCPSession<DummyPackets>> client) override
+        std::shared_ptr<net::Session<DummyPackets>> client) override
     {
         std::cout << "[Server] On client disconnected called. \n";
     }
 
-    void on_message(std::shared_ptr<net::TCPSession<DummyPackets>> client,
+    void on_message(std::shared_ptr<net::Session<DummyPackets>> client,
                     net::Packet<DummyPackets> packet) override
     {
         std::cout << "[Server] Packet received with packed id:  "
@@ -78,9 +158,19 @@ protected:
         }
     }
 
+    void on_messages(
+        std::shared_ptr<net::Session<DummyPackets>> client,
+        util::Span<net::OwnedPacket<DummyPackets>> messages) override
+    {
+        _batch_sizes.push_back(messages.size());
+        ServerInterface<DummyPackets>::on_messages(client, messages);
+    }
+
 private:
     std::vector<std::string> _usernames;
 
+    std::vector<std::size_t> _batch_sizes;
+
     /**
      * Used for testing, if the server has already received a packet or not.
      */
@@ -172,7 +262,8 @@ TEST_F(TestServer, test_send_received_message)
     std::this_thread::sleep_for(std::chrono::milliseconds(10));
 
     auto& received = client.input_queue();
-    auto response = received.pop_front();
+    net::OwnedPacket<DummyPackets> response;
+    ASSERT_TRUE(received.try_pop(response));
 
     ASSERT_EQ(response.packet.header.id, CONNECTION_RESPONSE);
 
@@ -183,4 +274,361 @@ TEST_F(TestServer, test_send_received_message)
     ASSERT_EQ(response_pb.status(), net::ConnectionResponse_Status_ACCEPTED);
 
     server.update();
-}
\ No newline at end of file
+}
+
+TEST_F(TestServer, test_io_thread_pool)
+{
+    DummyServer server(2049, 4);
+    server.start();
+
+    std::vector<std::unique_ptr<net::Client<DummyPackets>>> clients;
+    for (int i = 0; i < 8; i++) {
+        clients.push_back(std::make_unique<net::Client<DummyPackets>>());
+        clients.back()->connect("127.0.0.1", 2049);
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    for (std::size_t i = 0; i < clients.size(); i++) {
+        clients[i]->send(
+            make_connection_packet("client_" + std::to_string(i)));
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    server.update();
+
+    // every session has been served, whatever its io thread
+    ASSERT_EQ(server.usernames().size(), clients.size());
+
+    for (auto& client : clients) {
+        client->disconnect();
+    }
+    server.stop();
+}
+
+TEST_F(TestServer, test_send_many_packets)
+{
+    DummyServer server(2049);
+    server.start();
+
+    net::Client<DummyPackets> client;
+    client.connect("127.0.0.1", 2049);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    // queued packets are gathered in a few writes, in order
+    const int packet_count = 200;
+    for (int i = 0; i < packet_count; i++) {
+        client.send(make_connection_packet(std::to_string(i)));
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    server.update();
+
+    ASSERT_EQ(server.usernames().size(), packet_count);
+    for (int i = 0; i < packet_count; i++) {
+        ASSERT_EQ(server.usernames().at(i), std::to_string(i));
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    // the responses are received as well
+    int response_count = client.input_queue().drain(
+        [](net::OwnedPacket<DummyPackets>&& response) {
+            ASSERT_EQ(response.packet.header.id, CONNECTION_RESPONSE);
+        });
+    ASSERT_EQ(response_count, packet_count);
+
+    client.disconnect();
+    server.stop();
+}
+
+TEST_F(TestServer, test_update_batch)
+{
+    DummyServer server(2049);
+    server.start();
+
+    net::Client<DummyPackets> first_client;
+    first_client.connect("127.0.0.1", 2049);
+    net::Client<DummyPackets> second_client;
+    second_client.connect("127.0.0.1", 2049);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    for (int i = 0; i < 10; i++) {
+        (i % 2 == 0 ? first_client : second_client)
+            .send(make_connection_packet(std::to_string(i)));
+        if (i == 0) {
+            // the first session is the first to be received
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    // the deadline has passed, only the packets of the first session are
+    // handled
+    auto dispatched = server.update_until(std::chrono::steady_clock::now());
+    ASSERT_EQ(dispatched, 5);
+    ASSERT_EQ(server.usernames().front(), "0");
+    ASSERT_EQ(server.update_batch(), 5);
+    ASSERT_EQ(server.batch_sizes(), std::vector<std::size_t>({5, 5}));
+
+    // each session keeps the order of its packets
+    auto const& usernames = server.usernames();
+    ASSERT_EQ(usernames.size(), 10);
+    for (std::size_t i = 1; i < 5; i++) {
+        ASSERT_EQ(std::stoi(usernames[i]), std::stoi(usernames[i - 1]) + 2);
+        ASSERT_EQ(std::stoi(usernames[i + 5]),
+                  std::stoi(usernames[i + 4]) + 2);
+    }
+
+    first_client.disconnect();
+    second_client.disconnect();
+    server.stop();
+}
+
+TEST_F(TestServer, test_broadcast_shared_packet)
+{
+    DummyServer server(2049);
+    server.start();
+
+    std::vector<std::unique_ptr<net::Client<DummyPackets>>> clients;
+    for (int i = 0; i < 4; i++) {
+        clients.push_back(std::make_unique<net::Client<DummyPackets>>());
+        clients.back()->connect("127.0.0.1", 2049);
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+    net::Packet<DummyPackets> ping;
+    ping.header.id = PING;
+    ping.body = {1, 2, 3, 4};
+    ping.header.size = ping.body.size();
+
+    // the body is moved once into the shared packet, then shared
+    net::SharedPacket<DummyPackets> shared_ping(std::move(ping));
+    auto copy = shared_ping;
+    ASSERT_EQ(copy.body.get(), shared_ping.body.get());
+
+    server.message_all_clients(shared_ping);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+    for (auto& client : clients) {
+        net::OwnedPacket<DummyPackets> received;
+        ASSERT_TRUE(client->input_queue().try_pop(received));
+        ASSERT_EQ(received.packet.header.id, PING);
+        ASSERT_EQ(received.packet.body, net::buffer_t({1, 2, 3, 4}));
+        client->disconnect();
+    }
+    server.stop();
+}
+
+TEST_F(TestServer, test_send_large_packet)
+{
+    DummyServer server(2049);
+    server.start();
+
+    net::Client<DummyPackets> client;
+    client.connect("127.0.0.1", 2049);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    // larger than a read, framed over several reads
+    std::string username(100000, 'a');
+    auto connect_packet = make_connection_packet(username);
+    client.send(connect_packet);
+    client.send(connect_packet);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    server.update();
+
+    ASSERT_EQ(server.usernames().size(), 2);
+    ASSERT_EQ(server.usernames().at(1), username);
+
+    client.disconnect();
+    server.stop();
+}
+
+TEST_F(TestServer, test_buffer_pool_recycles)
+{
+    auto& pool = net::BufferPool::instance();
+    auto free_blocks = pool.free_blocks(100);
+
+    void* block = pool.allocate(100);
+    pool.deallocate(block, 100);
+    ASSERT_EQ(pool.free_blocks(100), free_blocks + 1);
+
+    // same size class, the freed block is handed back
+    ASSERT_EQ(pool.allocate(120), block);
+    ASSERT_EQ(pool.free_blocks(100), free_blocks);
+    pool.deallocate(block, 120);
+
+    {
+        net::buffer_t body(100);
+    }
+    ASSERT_EQ(pool.free_blocks(100), free_blocks + 1);
+
+    // the large classes keep less blocks, the retained bytes are capped
+    ASSERT_EQ(net::BufferPool::max_free(100),
+              net::BufferPool::max_free_blocks);
+    ASSERT_EQ(net::BufferPool::max_free(net::BufferPool::max_block_size), 1);
+    std::vector<void*> blocks;
+    for (int i = 0; i < 4; i++) {
+        blocks.push_back(pool.allocate(net::BufferPool::max_block_size));
+    }
+    for (auto* large_block : blocks) {
+        pool.deallocate(large_block, net::BufferPool::max_block_size);
+    }
+    ASSERT_EQ(pool.free_blocks(net::BufferPool::max_block_size), 1);
+}
+
+TEST_F(TestServer, test_sequence_wrap_around)
+{
+    ASSERT_TRUE(net::sequence_greater(1, 0));
+    ASSERT_FALSE(net::sequence_greater(0, 1));
+    ASSERT_FALSE(net::sequence_greater(5, 5));
+    ASSERT_TRUE(net::sequence_greater(2, 65534));
+    ASSERT_FALSE(net::sequence_greater(65534, 2));
+}
+
+TEST_F(TestServer, test_udp_session)
+{
+    DummyServer server(2049, 1, true);
+    server.set_udp_channel(PING, net::Channel::UNRELIABLE_SEQUENCED);
+    server.start();
+
+    net::Client<DummyPackets> client;
+    client.set_udp_channel(PING, net::Channel::UNRELIABLE_SEQUENCED);
+    ASSERT_TRUE(client.connect("127.0.0.1", 2049, true));
+
+    // reliable and fragmented, larger than a datagram
+    std::string username(5000, 'u');
+    auto connect_packet = make_connection_packet(username);
+    client.send(connect_packet);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    server.update();
+    ASSERT_EQ(server.usernames().size(), 1);
+    ASSERT_EQ(server.usernames().at(0), username);
+
+    // unreliable sequenced broadcast
+    for (std::uint8_t i = 0; i < 10; i++) {
+        net::Packet<DummyPackets> ping;
+        ping.header.id = PING;
+        ping.body = {i};
+        ping.header.size = 1;
+        server.message_all_clients(std::move(ping));
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    net::OwnedPacket<DummyPackets> received;
+    ASSERT_TRUE(client.input_queue().try_pop(received));
+    ASSERT_EQ(received.packet.header.id, CONNECTION_RESPONSE);
+
+    int last = -1;
+    while (client.input_queue().try_pop(received)) {
+        ASSERT_EQ(received.packet.header.id, PING);
+        ASSERT_GT(received.packet.body.at(0), last);
+        last = received.packet.body.at(0);
+    }
+    ASSERT_EQ(last, 9);
+
+    client.disconnect();
+    server.stop();
+}
+
+TEST_F(TestServer, test_udp_lossy_delivery)
+{
+    using namespace std::chrono_literals;
+    net::context_t context;
+    util::MPSCRingQueue<net::OwnedPacket<DummyPackets>> queue(1024);
+    auto loopback = boost::asio::ip::address_v4::loopback();
+    net::udp_socket_t socket(context, net::udp_endpoint_t(loopback, 0));
+    net::udp_socket_t remote(context, net::udp_endpoint_t(loopback, 0));
+    auto session = std::make_shared<net::UDPSession<DummyPackets>>(
+        socket, remote.local_endpoint(), context, queue);
+    session->connect_to_client(1);
+
+    auto receive = [&](std::uint16_t sequence) {
+        auto datagram = make_datagram(
+            net::DatagramHeader::DATA, sequence, sequence & 0xFF);
+        session->receive_datagram(datagram.data(), datagram.size());
+    };
+    auto acked = [](std::vector<net::DatagramHeader> const& headers) {
+        std::vector<std::uint16_t> sequences;
+        for (auto const& header : headers) {
+            if (header.kind == net::DatagramHeader::ACK) {
+                sequences.push_back(header.sequence);
+            }
+        }
+        return sequences;
+    };
+
+    // reordered and duplicated messages are buffered and acknowledged, the
+    // ones past the receive window are neither
+    receive(2);
+    receive(1);
+    receive(1);
+    receive(300);
+    ASSERT_EQ(acked(receive_datagrams(context, remote, 20ms)),
+              (std::vector<std::uint16_t>{2, 1, 1}));
+    net::OwnedPacket<DummyPackets> received;
+    ASSERT_FALSE(queue.try_pop(received));
+
+    // the missing message delivers the buffered ones in order, an old
+    // duplicate is acknowledged again but not delivered
+    receive(0);
+    receive(0);
+    ASSERT_EQ(acked(receive_datagrams(context, remote, 20ms)),
+              (std::vector<std::uint16_t>{0, 0}));
+    for (std::uint8_t i = 0; i < 3; i++) {
+        ASSERT_TRUE(queue.try_pop(received));
+        ASSERT_EQ(received.packet.body.at(0), i);
+    }
+    ASSERT_FALSE(queue.try_pop(received));
+
+    // an unacknowledged message is sent again until its ack arrives
+    net::Packet<DummyPackets> ping;
+    ping.header.id = PING;
+    ping.header.size = 1;
+    ping.body = {42};
+    session->send_packet(ping);
+    ASSERT_GE(receive_datagrams(context, remote, 250ms).size(), 2);
+    auto ack = make_datagram(net::DatagramHeader::ACK, 0);
+    session->receive_datagram(ack.data(), ack.size());
+    ASSERT_TRUE(receive_datagrams(context, remote, 250ms).empty());
+
+    // no more messages than the receive window are in flight, the others
+    // are sent as the acknowledgements arrive
+    for (int i = 0; i < 300; i++) {
+        session->send_packet(ping);
+    }
+    std::set<std::uint16_t> in_flight;
+    for (auto const& header : receive_datagrams(context, remote, 20ms)) {
+        in_flight.insert(header.sequence);
+    }
+    ASSERT_EQ(in_flight.size(), 256);
+    ASSERT_EQ(*in_flight.begin(), 1);
+    ASSERT_EQ(*in_flight.rbegin(), 256);
+    for (auto sequence : in_flight) {
+        ack = make_datagram(net::DatagramHeader::ACK, sequence);
+        session->receive_datagram(ack.data(), ack.size());
+    }
+    in_flight.clear();
+    for (auto const& header : receive_datagrams(context, remote, 20ms)) {
+        in_flight.insert(header.sequence);
+    }
+    ASSERT_EQ(in_flight.size(), 44);
+    ASSERT_EQ(*in_flight.begin(), 257);
+
+    session->disconnect();
+    context.restart();
+    context.run_for(20ms);
+}
@@ -0,0 +1,255 @@
+#include "net/client.hpp"
+#include "server/server_controller.hpp"
+#include <gtest/gtest.h>
+#include <optional>
+#include <string>
+
+class ServerControllerTest : public ::testing::Test {
+protected:
+    /**
+     * @return the connection message of a client, asking for an instance.
+     */
+    static net::Packet<server::HarakaPackets>
+    make_connection_packet(std::string const& username,
+                           util::slot_key_t instance = util::null_slot_key)
+    {
+        server::serialization::ConnectionResponse connection_pb;
+        connection_pb.set_username(username);
+        connection_pb.set_instance(instance);
+
+        net::Packet<server::HarakaPackets> packet;
+        packet.header.id = server::HarakaPackets::CONNECTION;
+        packet.header.size = connection_pb.ByteSizeLong();
+        packet.body.resize(packet.header.size);
+        connection_pb.SerializeToArray(packet.body.data(), packet.body.size());
+        return packet;
+    }
+
+    /**
+     * Dispatches the received packets until the condition holds.
+     * @return false if it still doesn't hold after a second.
+     */
+    template <typename F>
+    static bool dispatch_until(server::ServerController& server, F condition)
+    {
+        for (int i = 0; i < 1000; i++) {
+            server.update_batch();
+            if (condition()) {
+                return true;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return false;
+    }
+
+    /**
+     * Received update of a tick, a delta or a full snapshot.
+     */
+    struct Update {
+        server::HarakaPackets type;
+
+        /**
+         * Baseline tick of a delta update.
+         */
+        std::uint32_t prev_tick = 0;
+
+        std::string body;
+    };
+
+    /**
+     * Dispatches the packets received by the server until the client
+     * receives the update of a tick, skipping its older packets.
+     * @return the update, nullopt if it isn't received after a second.
+     */
+    static std::optional<Update>
+    receive_update(server::ServerController& server,
+                   net::Client<server::HarakaPackets>& client,
+                   std::uint32_t tick)
+    {
+        std::optional<Update> update;
+        dispatch_until(server, [&]() {
+            net::OwnedPacket<server::HarakaPackets> msg;
+            while (!update && client.input_queue().try_pop(msg)) {
+                auto const& packet = msg.packet;
+                std::string body(packet.body.begin(), packet.body.end());
+                if (packet.header.id == server::DELTA_SNAPSHOT_RESULT) {
+                    server::serialization::DeltaSnapshotUpdate buffer;
+                    buffer.ParseFromString(body);
+                    if (buffer.tick() == tick) {
+                        update = Update{
+                            server::DELTA_SNAPSHOT_RESULT,
+                            buffer.delta_snapshot().prev_tick(),
+                            body};
+                    }
+                }
+                else if (packet.header.id == server::FULL_SNAPSHOT_RESULT) {
+                    core::serialization::Snapshot buffer;
+                    buffer.ParseFromString(body);
+                    if (buffer.tick() == tick) {
+                        update = Update{server::FULL_SNAPSHOT_RESULT, 0, body};
+                    }
+                }
+            }
+            return update.has_value();
+        });
+        return update;
+    }
+
+    /**
+     * Acknowledges a tick, the update of the tick must have been received.
+     * The acknowledgement is followed by a full snapshot request, whose
+     * response means the acknowledgement has been handled.
+     */
+    static bool acknowledge(server::ServerController& server,
+                            net::Client<server::HarakaPackets>& client,
+                            std::uint32_t tick)
+    {
+        server::serialization::SnapshotAck ack_pb;
+        ack_pb.set_tick(tick);
+        net::Packet<server::HarakaPackets> ack;
+        ack.header.id = server::SNAPSHOT_ACK;
+        ack.header.size = ack_pb.ByteSizeLong();
+        ack.body.resize(ack.header.size);
+        ack_pb.SerializeToArray(ack.body.data(), ack.body.size());
+        client.send(ack);
+
+        net::Packet<server::HarakaPackets> request;
+        request.header.id = server::FULL_SNAPSHOT;
+        request.header.size = 0;
+        client.send(request);
+
+        auto response = receive_update(server, client, tick);
+        return response && response->type == server::FULL_SNAPSHOT_RESULT;
+    }
+};
+
+TEST_F(ServerControllerTest, test_instance_routing)
+{
+    server::ServerController server(15, 2050, 1, false, 0);
+    auto first = server.create_instance();
+    auto second = server.create_instance();
+    auto removed = server.create_instance();
+    ASSERT_TRUE(server.remove_instance(removed));
+    ASSERT_EQ(server.instance_count(), 2);
+    server.start();
+
+    std::vector<std::unique_ptr<net::Client<server::HarakaPackets>>> clients;
+    for (int i = 0; i < 4; i++) {
+        clients.push_back(
+            std::make_unique<net::Client<server::HarakaPackets>>());
+        clients.back()->connect("127.0.0.1", 2050);
+    }
+    auto routed = [&]() {
+        return server.session_count(first) + server.session_count(second);
+    };
+
+    // each connection is dispatched before the next one is sent, the first
+    // two clients are spread over the instances
+    clients[0]->send(make_connection_packet("first"));
+    ASSERT_TRUE(dispatch_until(server, [&]() { return routed() == 1; }));
+    clients[1]->send(make_connection_packet("second"));
+    ASSERT_TRUE(dispatch_until(server, [&]() { return routed() == 2; }));
+    ASSERT_EQ(server.session_count(first), 1);
+    ASSERT_EQ(server.session_count(second), 1);
+
+    // the requested instance is honoured
+    clients[2]->send(make_connection_packet("third", second));
+    ASSERT_TRUE(dispatch_until(server, [&]() { return routed() == 3; }));
+    ASSERT_EQ(server.session_count(second), 2);
+
+    // a made-up key (the next generation of a free slot) is ignored, the
+    // client goes to the emptiest instance
+    auto made_up = removed + (util::slot_key_t(1) << 32);
+    clients[3]->send(make_connection_packet("fourth", made_up));
+    ASSERT_TRUE(dispatch_until(server, [&]() { return routed() == 4; }));
+    ASSERT_EQ(server.session_count(first), 2);
+    ASSERT_EQ(server.session_count(made_up), 0);
+
+    // the clients of a removed instance are routed again at the next tick
+    ASSERT_TRUE(server.remove_instance(first));
+    ASSERT_FALSE(server.remove_instance(first));
+    ASSERT_EQ(server.instance(first), nullptr);
+    ASSERT_EQ(server.session_count(first), 0);
+
+    server.update_tick();
+    ASSERT_EQ(server.instance_count(), 1);
+    ASSERT_EQ(server.session_count(second), 4);
+
+    for (auto& client : clients) {
+        client->disconnect();
+    }
+    server.stop();
+}
+
+TEST_F(ServerControllerTest, test_delta_baselines)
+{
+    server::ServerController server(15, 2051, 1, false, 0);
+    auto instance = server.create_instance();
+    server.start();
+
+    std::vector<std::unique_ptr<net::Client<server::HarakaPackets>>> clients;
+    for (int i = 0; i < 3; i++) {
+        clients.push_back(
+            std::make_unique<net::Client<server::HarakaPackets>>());
+        clients.back()->connect("127.0.0.1", 2051);
+        clients.back()->send(make_connection_packet(std::to_string(i)));
+    }
+    auto& first = *clients[0];
+    auto& second = *clients[1];
+    auto& third = *clients[2];
+    ASSERT_TRUE(dispatch_until(server, [&]() {
+        return server.session_count(instance) == 3;
+    }));
+
+    auto current_tick = [&]() {
+        return server.instance(instance)->current_snapshot().tick();
+    };
+
+    // without acknowledgement, the clients get the delta of the tick
+    server.update_tick();
+    auto baseline = current_tick();
+    for (auto& client : clients) {
+        auto update = receive_update(server, *client, baseline);
+        ASSERT_TRUE(update);
+        ASSERT_EQ(update->type, server::DELTA_SNAPSHOT_RESULT);
+        ASSERT_EQ(update->prev_tick, baseline - 1);
+    }
+
+    for (auto& client : clients) {
+        ASSERT_TRUE(acknowledge(server, *client, baseline));
+    }
+    server.update_tick();
+    for (auto& client : clients) {
+        ASSERT_TRUE(receive_update(server, *client, current_tick()));
+    }
+    server.update_tick();
+
+    // the clients sharing the acknowledged baseline get the same update
+    auto first_update = receive_update(server, first, current_tick());
+    auto second_update = receive_update(server, second, current_tick());
+    ASSERT_TRUE(first_update && second_update);
+    ASSERT_EQ(first_update->type, server::DELTA_SNAPSHOT_RESULT);
+    ASSERT_EQ(first_update->prev_tick, baseline);
+    ASSERT_EQ(first_update->body, second_update->body);
+    ASSERT_TRUE(receive_update(server, third, current_tick()));
+
+    // the first client keeps acknowledging, while the baseline of the
+    // third one leaves the history
+    for (int i = 0; i < 40; i++) {
+        auto tick = current_tick();
+        ASSERT_TRUE(acknowledge(server, first, tick));
+        server.update_tick();
+        auto update = receive_update(server, first, current_tick());
+        ASSERT_TRUE(update);
+        ASSERT_EQ(update->type, server::DELTA_SNAPSHOT_RESULT);
+        ASSERT_EQ(update->prev_tick, tick);
+    }
+    auto third_update = receive_update(server, third, current_tick());
+    ASSERT_TRUE(third_update);
+    ASSERT_EQ(third_update->type, server::FULL_SNAPSHOT_RESULT);
+
+    for (auto& client : clients) {
+        client->disconnect();
+    }
+    server.stop();
+}
@@ -0,0 +1,71 @@
+#include "util/arena.hpp"
+#include "util/thread_pool.hpp"
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <memory_resource>
+#include <vector>
+
+class ArenaTest : public ::testing::Test {
+};
+
+TEST_F(ArenaTest, test_alignment)
+{
+    util::Arena arena(256);
+    for (std::size_t alignment = 1; alignment <= 64; alignment *= 2) {
+        auto* pointer = arena.allocate(3, alignment);
+        ASSERT_EQ(reinterpret_cast<std::uintptr_t>(pointer) % alignment, 0);
+    }
+    ASSERT_EQ(arena.block_count(), 1);
+
+    // bigger than a block
+    auto* big = static_cast<char*>(arena.allocate(1000, 8));
+    big[999] = 1;
+    ASSERT_EQ(arena.block_count(), 2);
+}
+
+TEST_F(ArenaTest, test_reset_reuses_memory)
+{
+    util::Arena arena(64);
+    auto fill = [&]() {
+        std::pmr::vector<std::uint64_t> values(&arena);
+        for (std::uint64_t i = 0; i < 1000; i++) {
+            values.push_back(i);
+        }
+        return values.data();
+    };
+
+    fill();
+    ASSERT_GT(arena.block_count(), 1);
+    auto capacity = arena.capacity();
+
+    // the blocks are merged, the next cycles fit in a single block
+    arena.reset();
+    ASSERT_EQ(arena.used(), 0);
+    ASSERT_EQ(arena.block_count(), 1);
+    ASSERT_EQ(arena.capacity(), capacity);
+
+    auto* first = fill();
+    arena.reset();
+    ASSERT_EQ(fill(), first);
+    ASSERT_EQ(arena.block_count(), 1);
+    ASSERT_EQ(arena.capacity(), capacity);
+}
+
+TEST_F(ArenaTest, test_concurrent_allocations)
+{
+    util::Arena arena(128);
+    util::ThreadPool pool(4);
+    std::vector<std::uint32_t*> pointers(10000);
+
+    pool.parallel_for(pointers.size(), [&](std::size_t index) {
+        pointers[index] = static_cast<std::uint32_t*>(
+            arena.allocate(sizeof(std::uint32_t), alignof(std::uint32_t)));
+        *pointers[index] = static_cast<std::uint32_t>(index);
+    });
+
+    // no two allocations overlap
+    for (std::size_t i = 0; i < pointers.size(); i++) {
+        ASSERT_EQ(*pointers[i], i);
+    }
+    ASSERT_GE(arena.used(), pointers.size() * sizeof(std::uint32_t));
+}
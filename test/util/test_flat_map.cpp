@@ -0,0 +1,94 @@
+#include "util/flat_map.hpp"
+#include <algorithm>
+#include <gtest/gtest.h>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+class FlatMapTest : public ::testing::Test {
+};
+
+TEST_F(FlatMapTest, test_insert_erase)
+{
+    util::FlatMap<std::string> map;
+    ASSERT_TRUE(map.empty());
+    ASSERT_EQ(map.find(0), map.end());
+
+    ASSERT_TRUE(map.emplace(3, "three").second);
+    ASSERT_TRUE(map.emplace(1, "one").second);
+    ASSERT_TRUE(map.insert({2, "two"}).second);
+    ASSERT_FALSE(map.emplace(2, "other").second);
+    ASSERT_EQ(map.size(), 3);
+    ASSERT_EQ(map.at(2), "two");
+    ASSERT_EQ(map.count(4), 0);
+    ASSERT_THROW(map.at(4), std::out_of_range);
+
+    // iterates in id order whatever the insertion order
+    std::vector<std::uint32_t> ids;
+    for (auto const& [id, value] : map) {
+        ids.push_back(id);
+    }
+    ASSERT_EQ(ids, std::vector<std::uint32_t>({1, 2, 3}));
+
+    ASSERT_EQ(map.erase(1), 1);
+    ASSERT_EQ(map.erase(1), 0);
+    ASSERT_EQ(map.at(2), "two");
+    ASSERT_EQ(map.at(3), "three");
+    ASSERT_EQ(map.lower_bound(1)->first, 2);
+
+    map[5] = "five";
+    ASSERT_EQ(map.find(5)->second, "five");
+    ASSERT_EQ(map.erase(map.find(2))->first, 3);
+    ASSERT_EQ(map.size(), 2);
+}
+
+TEST_F(FlatMapTest, test_sparse_ids)
+{
+    // ids far beyond the index are found by binary search
+    util::FlatMap<int> map;
+    map[1'000'000] = 1;
+    map[10] = 2;
+    map[4'000'000'000] = 3;
+    ASSERT_EQ(map.at(1'000'000), 1);
+    ASSERT_EQ(map.at(10), 2);
+    ASSERT_EQ(map.at(4'000'000'000), 3);
+    ASSERT_EQ(map.count(999'999), 0);
+    ASSERT_EQ(map.begin()->first, 10);
+}
+
+TEST_F(FlatMapTest, test_matches_std_map)
+{
+    util::FlatMap<int> map;
+    std::map<std::uint32_t, int> expected;
+    std::mt19937 random(42);
+    std::uniform_int_distribution<std::uint32_t> id(0, 2000);
+
+    for (int i = 0; i < 10000; i++) {
+        auto key = id(random);
+        if (random() % 3 == 0) {
+            ASSERT_EQ(map.erase(key), expected.erase(key));
+        }
+        else {
+            map[key] = i;
+            expected[key] = i;
+        }
+    }
+
+    ASSERT_EQ(map.size(), expected.size());
+    ASSERT_TRUE(std::equal(map.begin(),
+                           map.end(),
+                           expected.begin(),
+                           [](auto const& item, auto const& expected_item) {
+                               return item.first == expected_item.first
+                                      && item.second == expected_item.second;
+                           }));
+    for (std::uint32_t key = 0; key <= 2000; key++) {
+        ASSERT_EQ(map.count(key), expected.count(key));
+    }
+
+    auto copy = map;
+    ASSERT_EQ(copy, map);
+    copy.erase(copy.begin());
+    ASSERT_NE(copy, map);
+}
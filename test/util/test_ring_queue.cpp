@@ -0,0 +1,84 @@
+#include "util/ring_queue.hpp"
+#include <gtest/gtest.h>
+#include <thread>
+#include <vector>
+
+class RingQueueTest : public ::testing::Test {
+};
+
+TEST_F(RingQueueTest, test_bounded_capacity)
+{
+    util::MPSCRingQueue<int> queue(3);
+    ASSERT_EQ(queue.capacity(), 4);
+    ASSERT_TRUE(queue.empty());
+
+    for (int i = 0; i < 4; i++) {
+        ASSERT_TRUE(queue.try_push(i));
+    }
+    ASSERT_FALSE(queue.try_push(4));
+
+    int item;
+    ASSERT_TRUE(queue.try_pop(item));
+    ASSERT_EQ(item, 0);
+    ASSERT_TRUE(queue.try_push(4));
+
+    std::vector<int> drained;
+    auto count = queue.drain([&](int&& value) { drained.push_back(value); });
+    ASSERT_EQ(count, 4);
+    ASSERT_EQ(drained, std::vector<int>({1, 2, 3, 4}));
+    ASSERT_TRUE(queue.empty());
+    ASSERT_FALSE(queue.try_pop(item));
+}
+
+TEST_F(RingQueueTest, test_multiple_producers)
+{
+    constexpr int producer_count = 4;
+    constexpr int item_count = 10000;
+    util::MPSCRingQueue<int> queue(64);
+
+    std::vector<std::thread> producers;
+    for (int producer = 0; producer < producer_count; producer++) {
+        producers.emplace_back([&queue, producer]() {
+            for (int i = 0; i < item_count; i++) {
+                queue.push(producer * item_count + i);
+            }
+        });
+    }
+
+    // items of each producer are received in order
+    std::vector<int> last(producer_count, -1);
+    int received = 0;
+    while (received < producer_count * item_count) {
+        queue.wait();
+        received += queue.drain([&](int&& value) {
+            auto producer = value / item_count;
+            ASSERT_GT(value % item_count, last[producer]);
+            last[producer] = value % item_count;
+        });
+    }
+
+    for (auto& producer : producers) {
+        producer.join();
+    }
+    ASSERT_TRUE(queue.empty());
+}
+
+TEST_F(RingQueueTest, test_single_producer)
+{
+    constexpr int item_count = 100000;
+    util::SPSCRingQueue<int> queue(16);
+
+    std::thread producer([&queue]() {
+        for (int i = 0; i < item_count; i++) {
+            queue.push(i);
+        }
+    });
+
+    int expected = 0;
+    while (expected < item_count) {
+        queue.wait();
+        queue.drain([&](int&& value) { ASSERT_EQ(value, expected++); });
+    }
+    producer.join();
+    ASSERT_TRUE(queue.empty());
+}
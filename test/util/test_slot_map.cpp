@@ -0,0 +1,77 @@
+#include "util/slot_map.hpp"
+#include <algorithm>
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+class SlotMapTest : public ::testing::Test {
+};
+
+TEST_F(SlotMapTest, test_insert_erase)
+{
+    util::SlotMap<std::string> map;
+    ASSERT_TRUE(map.empty());
+    ASSERT_EQ(map.get(util::null_slot_key), nullptr);
+
+    auto first = map.insert("first");
+    auto second = map.insert("second");
+    auto third = map.insert("third");
+    ASSERT_NE(first, util::null_slot_key);
+    ASSERT_EQ(map.size(), 3);
+    ASSERT_EQ(*map.get(second), "second");
+
+    // the last value fills the hole, the other keys stay valid
+    ASSERT_TRUE(map.erase(first));
+    ASSERT_FALSE(map.erase(first));
+    ASSERT_EQ(map.size(), 2);
+    ASSERT_EQ(map.get(first), nullptr);
+    ASSERT_EQ(*map.get(second), "second");
+    ASSERT_EQ(*map.get(third), "third");
+
+    std::vector<std::string> values(map.begin(), map.end());
+    std::sort(values.begin(), values.end());
+    ASSERT_EQ(values, std::vector<std::string>({"second", "third"}));
+    for (std::size_t i = 0; i < map.size(); i++) {
+        ASSERT_EQ(*map.get(map.key_at(i)), *(map.begin() + i));
+    }
+}
+
+TEST_F(SlotMapTest, test_stale_key)
+{
+    util::SlotMap<int> map;
+    auto key = map.insert(1);
+    map.erase(key);
+
+    // the slot is reused with a new generation
+    auto new_key = map.insert(2);
+    ASSERT_NE(key, new_key);
+    ASSERT_FALSE(map.contains(key));
+    ASSERT_EQ(map.get(key), nullptr);
+    ASSERT_EQ(*map.get(new_key), 2);
+
+    map.clear();
+    ASSERT_TRUE(map.empty());
+    ASSERT_FALSE(map.contains(new_key));
+}
+
+TEST_F(SlotMapTest, test_made_up_key)
+{
+    util::SlotMap<int> map;
+    auto first = map.insert(1);
+    auto second = map.insert(2);
+    auto third = map.insert(3);
+    map.erase(first);
+    map.erase(second);
+
+    // the next generation of a freed slot has not been given out yet, its
+    // index is a free list link: none for the first slot, the first slot
+    // (a used value index) for the second one
+    for (auto key : {first, second}) {
+        auto made_up = key + (util::slot_key_t(1) << 32);
+        ASSERT_FALSE(map.contains(made_up));
+        ASSERT_EQ(map.get(made_up), nullptr);
+        ASSERT_FALSE(map.erase(made_up));
+    }
+    ASSERT_EQ(*map.get(third), 3);
+    ASSERT_FALSE(map.contains(util::null_slot_key));
+}
@@ -0,0 +1,46 @@
+#include "util/thread_pool.hpp"
+#include <atomic>
+#include <gtest/gtest.h>
+#include <stdexcept>
+#include <vector>
+
+class ThreadPoolTest : public ::testing::Test {
+};
+
+TEST_F(ThreadPoolTest, test_parallel_for)
+{
+    util::ThreadPool pool(4);
+    ASSERT_EQ(pool.size(), 4);
+
+    std::vector<int> values(1000, 0);
+    pool.parallel_for(
+        values.size(), [&](std::size_t i) { values[i] += i; }, 16);
+    for (std::size_t i = 0; i < values.size(); i++) {
+        ASSERT_EQ(values[i], i);
+    }
+
+    // nested calls from the workers don't starve the pool
+    std::atomic<int> count{0};
+    pool.parallel_for(8, [&](std::size_t) {
+        pool.parallel_for(8, [&](std::size_t) { count++; });
+    });
+    ASSERT_EQ(count.load(), 64);
+}
+
+TEST_F(ThreadPoolTest, test_exception)
+{
+    util::ThreadPool pool(2);
+    ASSERT_THROW(pool.parallel_for(100,
+                                   [](std::size_t i) {
+                                       if (i == 42) {
+                                           throw std::runtime_error("42");
+                                       }
+                                   }),
+                 std::runtime_error);
+
+    // without workers everything runs on the calling thread
+    util::ThreadPool inline_pool(0);
+    int sum = 0;
+    inline_pool.parallel_for(10, [&](std::size_t i) { sum += i; });
+    ASSERT_EQ(sum, 45);
+}
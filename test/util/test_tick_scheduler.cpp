@@ -0,0 +1,82 @@
+#include "util/tick_scheduler.hpp"
+#include <gtest/gtest.h>
+#include <thread>
+
+class TickSchedulerTest : public ::testing::Test {
+};
+
+TEST_F(TickSchedulerTest, test_fixed_rate)
+{
+    util::TickScheduler scheduler(100);
+    ASSERT_EQ(scheduler.period(), std::chrono::milliseconds(10));
+
+    auto start = util::TickScheduler::clock_t::now();
+    scheduler.run([&](util::TickScheduler::clock_t::time_point deadline) {
+        // the deadlines follow the schedule from the first tick
+        auto expected =
+            start + scheduler.period() * (scheduler.tick_count() + 1);
+        ASSERT_LT(deadline - expected, std::chrono::milliseconds(1));
+        if (scheduler.tick_count() == 19) {
+            scheduler.stop();
+        }
+    });
+    auto elapsed = util::TickScheduler::clock_t::now() - start;
+
+    // 20 ticks, the first one runs right away
+    ASSERT_EQ(scheduler.tick_count(), 20);
+    ASSERT_EQ(scheduler.skipped_ticks(), 0);
+    ASSERT_GE(elapsed, std::chrono::milliseconds(190));
+}
+
+TEST_F(TickSchedulerTest, test_catch_up)
+{
+    util::TickScheduler scheduler(100, 2);
+
+    std::uint64_t late_ticks = 0;
+    scheduler.run([&](util::TickScheduler::clock_t::time_point deadline) {
+        // the tick was due a period before its deadline
+        auto lateness = util::TickScheduler::clock_t::now()
+                        - (deadline - scheduler.period());
+        if (lateness > std::chrono::milliseconds(5)) {
+            late_ticks++;
+        }
+        if (scheduler.tick_count() == 0) {
+            // the second tick is 4 periods late, it is caught up (the first
+            // tick counts in max_catch_up) and the next ones are dropped
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+        else if (scheduler.tick_count() == 3) {
+            scheduler.stop();
+        }
+    });
+
+    // the third and fourth ticks run on schedule again
+    ASSERT_EQ(scheduler.tick_count(), 4);
+    ASSERT_EQ(late_ticks, 1);
+    ASSERT_GE(scheduler.skipped_ticks(), 4);
+}
+
+TEST_F(TickSchedulerTest, test_stop_while_late)
+{
+    util::TickScheduler scheduler(100);
+    scheduler.run([&](util::TickScheduler::clock_t::time_point) {
+        // late, but the stop request ends the catch up
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        scheduler.stop();
+    });
+
+    ASSERT_EQ(scheduler.tick_count(), 1);
+}
+
+TEST_F(TickSchedulerTest, test_stop_from_thread)
+{
+    util::TickScheduler scheduler(1000);
+    std::thread runner([&]() {
+        scheduler.run([](util::TickScheduler::clock_t::time_point) {});
+    });
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    scheduler.stop();
+    runner.join();
+    ASSERT_GT(scheduler.tick_count(), 0);
+}